@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <any>
@@ -10,66 +11,1569 @@
 #include <optional>
 #include <memory>
 #include <iostream>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <atomic>
+#include <mutex>
 
-class Node {
-    std::string m_name;
-    std::any m_data; 
-    static size_t m_default_name_idx;
+#include "small_vector.h"
+#include "string_interner.h"
+#include "node_set.h"
+#include "graph_traits.h"
+
+template <typename NodeData>
+class BasicNodeArena;
+
+// Name handling shared by every node type; the graph topology only ever
+// sees nodes through this base.
+class NodeBase {
+    std::string_view m_name;
+    std::string m_owned_name; // empty for nodes whose name lives in a graph's interner
+    // id in the first graph the node joined, see NodeIdMap
+    std::atomic<uint64_t> m_graph_tag{0};
+    NodeId m_graph_id = 0;
+    static std::atomic<size_t> m_default_name_idx;
+    template <typename NodeData>
+    friend class BasicNodeArena;
+    friend class NodeIdMap;
+    protected:
+        struct Interned {};
+        static std::string defaultName();
+        NodeBase(const std::string& name);
+        NodeBase(std::string_view interned_name, Interned);
+        NodeBase(const NodeBase& other);
+        NodeBase(NodeBase&& other);
     public:
-        Node(const std::any& data, const std::string& name);
-        Node(const std::any& data);
-        Node(const Node& other) = default;
-        Node(Node&& other) = default;
-        std::string name() const;
-        const std::any& data() const;
+        std::string_view name() const;
 };
 
-using PtrNode = std::shared_ptr<Node>;
+template <typename NodeData>
+class BasicNode: public NodeBase {
+    NodeData m_data;
+    BasicNode(const NodeData& data, std::string_view interned_name, Interned): NodeBase(interned_name, Interned{}), m_data(data) {}
+    friend class BasicNodeArena<NodeData>;
+    public:
+        BasicNode(const NodeData& data, const std::string& name): NodeBase(name), m_data(data) {}
+        BasicNode(const NodeData& data): NodeBase(defaultName()), m_data(data) {}
+        BasicNode(const BasicNode& other) = default;
+        BasicNode(BasicNode&& other) = default;
+        const NodeData& data() const { return m_data; }
+};
 
-struct DirectedEdge {
-    PtrNode from;
-    PtrNode to;
+// Owns the nodes of a graph. Nodes are constructed in place inside fixed-size
+// chunks, so their addresses are stable and teardown frees a few chunks
+// rather than one allocation per node. Nodes created elsewhere and handed to
+// a graph are adopted, i.e. kept alive alongside the arena's own.
+template <typename NodeData>
+class BasicNodeArena {
+    using NodeType = BasicNode<NodeData>;
+    static constexpr size_t kChunkSize = 1024;
+    struct Slot {
+        alignas(NodeType) unsigned char bytes[sizeof(NodeType)];
+    };
+    std::vector<std::unique_ptr<Slot[]>> m_chunks;
+    size_t m_num_created = 0;
+    std::vector<std::shared_ptr<NodeType>> m_adopted;
+    std::vector<std::shared_ptr<BasicNodeArena>> m_absorbed;
+    std::shared_ptr<StringInterner> m_names;
+    NodeType* allocate(const NodeData& data, std::string_view interned_name) {
+        if (m_num_created % kChunkSize == 0) {
+            m_chunks.emplace_back(new Slot[kChunkSize]);
+        }
+        Slot& slot = m_chunks.back()[m_num_created % kChunkSize];
+        NodeType* node = new (slot.bytes) NodeType(data, interned_name, NodeBase::Interned{});
+        m_num_created++;
+        return node;
+    }
+    public:
+        BasicNodeArena(): BasicNodeArena(std::make_shared<StringInterner>()) {}
+        BasicNodeArena(std::shared_ptr<StringInterner> names): m_names(std::move(names)) {}
+        BasicNodeArena(const BasicNodeArena&) = delete;
+        BasicNodeArena& operator=(const BasicNodeArena&) = delete;
+        ~BasicNodeArena() {
+            if constexpr (!std::is_trivially_destructible_v<NodeType>) {
+                for (size_t i = 0; i < m_num_created; ++i) {
+                    std::launder(reinterpret_cast<NodeType*>(m_chunks[i / kChunkSize][i % kChunkSize].bytes))->~NodeType();
+                }
+            }
+        }
+        NodeType* create(const NodeData& data) { return allocate(data, m_names->intern(NodeBase::defaultName())); }
+        NodeType* create(const NodeData& data, std::string_view name) { return allocate(data, m_names->intern(name)); }
+        const std::shared_ptr<StringInterner>& names() const { return m_names; }
+        NodeType* adopt(const std::shared_ptr<NodeType>& node) {
+            m_adopted.push_back(node);
+            return node.get();
+        }
+        // Keeps another arena's nodes alive as part of this one, e.g. the
+        // arena a builder shard filled on its own thread.
+        void absorb(std::shared_ptr<BasicNodeArena> other) { m_absorbed.push_back(std::move(other)); }
+        size_t size() const {
+            size_t total = m_num_created + m_adopted.size();
+            for (const auto& arena: m_absorbed) {
+                total += arena->size();
+            }
+            return total;
+        }
+};
+
+template <typename NodeData>
+struct BasicDirectedEdge {
+    std::shared_ptr<BasicNode<NodeData>> from;
+    std::shared_ptr<BasicNode<NodeData>> to;
     std::string label;
 };
 
-class DirectedGraph {
-    std::string m_name;
-    using MapStrVecNodeLabelPair = std::unordered_map<std::string, std::vector<std::pair<PtrNode, std::string>>>;
-    std::unordered_map<PtrNode, MapStrVecNodeLabelPair> m_adj;
-    public:
-        DirectedGraph();
-        DirectedGraph(const std::string& name);
-        DirectedGraph(const std::string& name, const std::vector<PtrNode>& nodes);
-        bool hasNode(PtrNode node) const;
-        std::optional<PtrNode> nodeByName(const std::string& name) const;
-        bool addNode(PtrNode node);
-        bool addEdge(PtrNode from, PtrNode to);
-        bool addEdge(PtrNode from, PtrNode to, const std::string& label);
-        bool removeEdge(PtrNode from, PtrNode to);
-        std::vector<PtrNode> nodes() const;
-        std::vector<PtrNode> nodes_sorted() const;
-        std::vector<PtrNode> top() const;
-        std::vector<PtrNode> bottom() const;
-        std::vector<DirectedEdge> edges() const;
-        std::vector<PtrNode> inbound(PtrNode node) const ;
-        std::vector<PtrNode> outbound(PtrNode node) const ;
+class NodeIdRange {
+    const NodeId* m_begin;
+    const NodeId* m_end;
+    public:
+        NodeIdRange(const NodeId* begin, const NodeId* end): m_begin(begin), m_end(end) {}
+        const NodeId* begin() const { return m_begin; }
+        const NodeId* end() const { return m_end; }
+        size_t size() const { return m_end - m_begin; }
+        bool empty() const { return m_begin == m_end; }
+};
+
+struct Neighbor {
+    NodeId node;
+    uint32_t label;
+};
+
+// Most nodes have fewer than four edges each way, so those stay inline.
+using NeighborList = SmallVector<Neighbor, 4>;
+
+struct Adjacency {
+    NeighborList inbound;
+    NeighborList outbound;
+};
+
+// Iterates a node's neighbors in place, yielding references into the graph's
+// node table so no vector is built and no refcount is touched.
+template <typename NodeType>
+class NeighborRange {
+    const Neighbor* m_begin;
+    const Neighbor* m_end;
+    NodeBase* const* m_nodes;
+    public:
+        class iterator {
+            const Neighbor* m_pos;
+            NodeBase* const* m_nodes;
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = NodeType;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const NodeType*;
+                using reference = const NodeType&;
+                iterator(const Neighbor* pos, NodeBase* const* nodes): m_pos(pos), m_nodes(nodes) {}
+                const NodeType& operator*() const { return *static_cast<const NodeType*>(m_nodes[m_pos->node]); }
+                const NodeType* operator->() const { return static_cast<const NodeType*>(m_nodes[m_pos->node]); }
+                NodeId id() const { return m_pos->node; }
+                uint32_t label() const { return m_pos->label; }
+                iterator& operator++() { ++m_pos; return *this; }
+                iterator operator++(int) { iterator prev = *this; ++m_pos; return prev; }
+                bool operator==(const iterator& other) const { return m_pos == other.m_pos; }
+                bool operator!=(const iterator& other) const { return m_pos != other.m_pos; }
+        };
+        NeighborRange(const NeighborList& list, NodeBase* const* nodes): m_begin(list.begin()), m_end(list.end()), m_nodes(nodes) {}
+        iterator begin() const { return {m_begin, m_nodes}; }
+        iterator end() const { return {m_end, m_nodes}; }
+        size_t size() const { return m_end - m_begin; }
+        bool empty() const { return m_begin == m_end; }
+};
+
+// The ids in a neighbor list, without their labels.
+class NeighborIdRange {
+    const Neighbor* m_begin;
+    const Neighbor* m_end;
+    public:
+        class iterator {
+            const Neighbor* m_pos;
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = NodeId;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const NodeId*;
+                using reference = const NodeId&;
+                iterator(const Neighbor* pos): m_pos(pos) {}
+                const NodeId& operator*() const { return m_pos->node; }
+                iterator& operator++() { ++m_pos; return *this; }
+                bool operator==(const iterator& other) const { return m_pos == other.m_pos; }
+                bool operator!=(const iterator& other) const { return m_pos != other.m_pos; }
+        };
+        NeighborIdRange(const NeighborList& list): m_begin(list.begin()), m_end(list.end()) {}
+        iterator begin() const { return {m_begin}; }
+        iterator end() const { return {m_end}; }
+        size_t size() const { return m_end - m_begin; }
+};
+
+// One edge seen while streaming a graph. Everything refers into the graph
+// and stays valid as long as the graph is not modified.
+template <typename NodeType>
+struct EdgeRef {
+    NodeId from_id;
+    NodeId to_id;
+    const NodeType& from;
+    const NodeType& to;
+    std::string_view label;
 };
 
+// Every edge of a DirectedGraph, grouped by source, read straight from the
+// adjacency lists without allocating.
+template <typename NodeType>
+class EdgeRange {
+    const Adjacency* m_adj;
+    NodeBase* const* m_nodes;
+    const std::string* m_labels;
+    NodeId m_size;
+    public:
+        class iterator {
+            const EdgeRange* m_range;
+            NodeId m_node;
+            uint32_t m_pos = 0;
+            void skipEmpty() {
+                while (m_node < m_range->m_size && m_pos == m_range->m_adj[m_node].outbound.size()) {
+                    m_node++;
+                    m_pos = 0;
+                }
+            }
+            public:
+                using iterator_category = std::input_iterator_tag;
+                using value_type = EdgeRef<NodeType>;
+                using difference_type = std::ptrdiff_t;
+                using pointer = void;
+                using reference = EdgeRef<NodeType>;
+                iterator(const EdgeRange* range, NodeId node): m_range(range), m_node(node) { skipEmpty(); }
+                EdgeRef<NodeType> operator*() const {
+                    const Neighbor& out = m_range->m_adj[m_node].outbound[m_pos];
+                    return {m_node, out.node, *static_cast<const NodeType*>(m_range->m_nodes[m_node]),
+                            *static_cast<const NodeType*>(m_range->m_nodes[out.node]), m_range->m_labels[out.label]};
+                }
+                iterator& operator++() {
+                    m_pos++;
+                    skipEmpty();
+                    return *this;
+                }
+                bool operator==(const iterator& other) const { return m_node == other.m_node && m_pos == other.m_pos; }
+                bool operator!=(const iterator& other) const { return !(*this == other); }
+        };
+        EdgeRange(const Adjacency* adj, NodeBase* const* nodes, const std::string* labels, NodeId size):
+                m_adj(adj), m_nodes(nodes), m_labels(labels), m_size(size) {}
+        iterator begin() const { return {this, 0}; }
+        iterator end() const { return {this, m_size}; }
+};
+
+// Result of a level-synchronous topological sort. Level 0 holds the nodes
+// without inbound edges and every other node sits one level below its
+// deepest predecessor. Nodes on or downstream of a cycle are never released
+// and keep kNoLevel.
+struct TopologicalLevels {
+    static constexpr uint32_t kNoLevel = std::numeric_limits<uint32_t>::max();
+    std::vector<NodeId> order;     // grouped by level, ascending ids within one, for any thread count
+    std::vector<uint32_t> level;   // indexed by NodeId
+    std::vector<uint32_t> offsets; // level l is order[offsets[l], offsets[l + 1])
+    size_t numLevels() const { return offsets.size() - 1; }
+    bool complete() const { return order.size() == level.size(); }
+};
+
+// Finds a node's id in one graph. The first graph a node joins stamps its tag
+// and the id into the node, so looking that up is a field read; only nodes
+// that already belonged to another graph get a hash entry. Tags are never
+// reused, so a node outliving its first graph is simply treated as shared.
+class NodeIdMap {
+    static std::atomic<uint64_t> m_next_tag;
+    uint64_t m_tag;
+    std::unordered_map<const NodeBase*, NodeId> m_shared;
+    static uint64_t nextTag() { return m_next_tag.fetch_add(1, std::memory_order_relaxed); }
+    public:
+        NodeIdMap(): m_tag(nextTag()) {}
+        NodeIdMap(const NodeIdMap& other) = default;
+        // the moved-from map gets a fresh tag so it cannot claim nodes as the new owner
+        NodeIdMap(NodeIdMap&& other): m_tag(other.m_tag), m_shared(std::move(other.m_shared)) { other.m_tag = nextTag(); }
+        void insert(NodeBase* node, NodeId id) {
+            uint64_t unclaimed = 0;
+            if (node->m_graph_tag.compare_exchange_strong(unclaimed, m_tag, std::memory_order_relaxed)) {
+                node->m_graph_id = id;
+            }
+            else {
+                m_shared.emplace(node, id);
+            }
+        }
+        // Ids at or above size belong to nodes added after a snapshot was taken.
+        std::optional<NodeId> find(const NodeBase* node, size_t size) const {
+            if (node->m_graph_tag.load(std::memory_order_relaxed) == m_tag) {
+                if (node->m_graph_id < size) {
+                    return {node->m_graph_id};
+                }
+                return {};
+            }
+            auto iter = m_shared.find(node);
+            if (iter == m_shared.end() || iter->second >= size) {
+                return {};
+            }
+            return {iter->second};
+        }
+        NodeId at(const NodeBase* node, size_t size) const {
+            auto id = find(node, size);
+            if (!id.has_value()) {
+                throw std::out_of_range("Node: " + std::string(node->name()) + " not present in graph");
+            }
+            return id.value();
+        }
+};
+
+// Open-addressed name -> id table holding only ids and hash bits, so indexing
+// a node never allocates. Names are read back through the node table the
+// caller passes in. The first node inserted under a name wins.
+class NameIndex {
+    struct Slot {
+        NodeId id;
+        uint32_t hash;
+    };
+    static constexpr NodeId kEmpty = std::numeric_limits<NodeId>::max();
+    std::vector<Slot> m_slots; // power-of-two size, at most 3/4 full
+    size_t m_size = 0;
+    static uint32_t hash(std::string_view name) { return static_cast<uint32_t>(std::hash<std::string_view>{}(name)); }
+    void rehash(size_t num_slots);
+    public:
+        void reserve(size_t num_names);
+        void insert(NodeId id, const std::vector<NodeBase*>& nodes);
+        std::optional<NodeId> find(std::string_view name, const std::vector<NodeBase*>& nodes) const;
+};
+
+// Payload-independent part of a DirectedGraph: node table, name index,
+// adjacency and edge labels, all addressed by NodeId. Compiled once in
+// graph.cc no matter how many payload types are in use.
+class GraphTopology {
+    friend class CompactGraphTopology;
+    friend struct GraphTraits<GraphTopology>;
+    friend class GraphBuilderBase;
+    protected:
+        // Neighbor lists longer than this get a position index so duplicate
+        // checks and removals stay O(1) on high fan-out nodes.
+        static constexpr uint32_t kIndexedDegree = 16;
+        using NeighborIndex = std::unordered_map<NodeId, uint32_t>;
+        std::string m_name;
+        std::vector<NodeBase*> m_nodes;
+        NodeIdMap m_ids;
+        NameIndex m_name_index;
+        std::vector<Adjacency> m_adj;
+        std::unordered_map<NodeId, NeighborIndex> m_out_index;
+        std::unordered_map<NodeId, NeighborIndex> m_in_index;
+        std::vector<std::string> m_labels{std::string{}};
+        std::unordered_map<std::string, uint32_t> m_label_ids;
+        uint64_t m_version = 0;
+        // Topological order kept up to date across edits (Pearce-Kelly), only
+        // allocated while enabled.
+        struct DynamicOrder {
+            std::vector<NodeId> order;
+            std::vector<uint32_t> position;
+            std::vector<uint32_t> visited;
+            uint32_t epoch = 0;
+            std::vector<NodeId> stack;
+            std::vector<NodeId> forward;
+            std::vector<NodeId> backward;
+            std::vector<uint32_t> slots;
+        };
+        std::unique_ptr<DynamicOrder> m_order;
+        GraphTopology(const std::string& name): m_name(name) {}
+        NodeId insertNode(NodeBase* node);
+        uint32_t labelId(const std::string& label);
+        uint32_t findNeighbor(NodeId owner, NodeId neighbor, bool outbound) const;
+        void appendNeighbor(NodeId owner, Neighbor neighbor, bool outbound);
+        void eraseNeighbor(NodeId owner, uint32_t pos, bool outbound);
+        void reorder(NodeId from, NodeId to);
+    public:
+        std::optional<NodeId> idByName(std::string_view name) const;
+        std::vector<NodeId> idsByName(const std::vector<std::string>& names) const;
+        void reserve(size_t num_nodes);
+        bool addEdge(NodeId from, NodeId to);
+        bool addEdge(NodeId from, NodeId to, const std::string& label);
+        bool removeEdge(NodeId from, NodeId to);
+        std::vector<NodeId> sortedIds() const;
+        // num_threads = 0 uses every hardware thread; small levels run inline.
+        TopologicalLevels levels(unsigned num_threads = 0) const;
+        // Linear time, iterative, so deep graphs cannot overflow the stack.
+        StronglyConnectedComponents components() const;
+        // A shortest cycle through some node, in path order, or empty on a DAG.
+        std::vector<NodeId> findCycle() const;
+        // Once enabled, addEdge throws on an edge that would close a cycle and
+        // leaves the graph unchanged, and topologicalOrder() is always current.
+        void enableTopologicalOrder();
+        void disableTopologicalOrder() { m_order.reset(); }
+        bool hasTopologicalOrder() const { return m_order != nullptr; }
+        const std::vector<NodeId>& topologicalOrder() const;
+        uint32_t topologicalIndex(NodeId id) const;
+        std::vector<NodeId> topIds() const;
+        std::vector<NodeId> bottomIds() const;
+        size_t size() const { return m_nodes.size(); }
+        const std::string& label(uint32_t label_id) const { return m_labels[label_id]; }
+        uint64_t version() const { return m_version; }
+};
+
+template <>
+struct GraphTraits<GraphTopology> {
+    using NodeHandle = const NodeBase*;
+    static size_t idBound(const GraphTopology& graph) { return graph.size(); }
+    static IdSequence nodes(const GraphTopology& graph) { return graph.size(); }
+    static NeighborIdRange inbound(const GraphTopology& graph, NodeId id) { return graph.m_adj[id].inbound; }
+    static NeighborIdRange outbound(const GraphTopology& graph, NodeId id) { return graph.m_adj[id].outbound; }
+    static NodeHandle node(const GraphTopology& graph, NodeId id) { return graph.m_nodes[id]; }
+    static std::string_view nodeName(const GraphTopology& graph, NodeId id) { return graph.m_nodes[id]->name(); }
+};
+
+template <typename NodeData>
+class BasicCompactDirectedGraph;
+
+template <typename NodeData>
+class BasicGraphBuilder;
+
+template <typename NodeData>
+class BasicDirectedGraph: public GraphTopology {
+    friend class BasicCompactDirectedGraph<NodeData>;
+    friend class BasicGraphBuilder<NodeData>;
+    public:
+        using NodeType = BasicNode<NodeData>;
+        using NodePtr = std::shared_ptr<NodeType>;
+        using Edge = BasicDirectedEdge<NodeData>;
+    private:
+        std::shared_ptr<BasicNodeArena<NodeData>> m_arena;
+        NodeId ensureNode(const NodePtr& node) {
+            if (auto id = m_ids.find(node.get(), size())) {
+                return id.value();
+            }
+            return insertNode(m_arena->adopt(node));
+        }
+        std::vector<NodePtr> toNodes(const std::vector<NodeId>& ids) const {
+            std::vector<NodePtr> nodes;
+            nodes.reserve(ids.size());
+            for (NodeId id: ids) {
+                nodes.push_back(node(id));
+            }
+            return nodes;
+        }
+    public:
+        BasicDirectedGraph(): BasicDirectedGraph(std::string{"G"}) {}
+        BasicDirectedGraph(const std::string& name):
+                GraphTopology(name), m_arena(std::make_shared<BasicNodeArena<NodeData>>()) {}
+        BasicDirectedGraph(const std::string& name, std::shared_ptr<StringInterner> names):
+                GraphTopology(name), m_arena(std::make_shared<BasicNodeArena<NodeData>>(std::move(names))) {}
+        BasicDirectedGraph(const std::string& name, const std::vector<NodePtr>& nodes): BasicDirectedGraph(name) {
+            for(const NodePtr& node: nodes) {
+                addNode(node);
+            }
+        }
+        bool hasNode(const NodePtr& node) const { return m_ids.find(node.get(), size()).has_value(); }
+        std::optional<NodePtr> nodeByName(std::string_view name) const {
+            auto id = idByName(name);
+            if (!id.has_value()) {
+                return {};
+            }
+            return {node(id.value())};
+        }
+        std::vector<NodePtr> nodesByName(const std::vector<std::string>& names) const { return toNodes(idsByName(names)); }
+        bool addNode(const NodePtr& node) {
+            size_t num_nodes = size();
+            ensureNode(node);
+            return size() != num_nodes;
+        }
+        NodeId createNode(const NodeData& data) { return insertNode(m_arena->create(data)); }
+        NodeId createNode(const NodeData& data, std::string_view name) { return insertNode(m_arena->create(data, name)); }
+        using GraphTopology::addEdge;
+        using GraphTopology::removeEdge;
+        bool addEdge(const NodePtr& from, const NodePtr& to) { return addEdge(from, to, std::string{}); }
+        bool addEdge(const NodePtr& from, const NodePtr& to, const std::string& label) {
+            NodeId from_id = ensureNode(from);
+            return addEdge(from_id, ensureNode(to), label);
+        }
+        bool removeEdge(const NodePtr& from, const NodePtr& to) {
+            auto from_id = id(from);
+            auto to_id = id(to);
+            if (!from_id.has_value() || !to_id.has_value()) {
+                return false;
+            }
+            return removeEdge(from_id.value(), to_id.value());
+        }
+        std::vector<NodePtr> nodes() const;
+        std::vector<NodePtr> nodes_sorted() const { return toNodes(sortedIds()); }
+        std::vector<NodePtr> top() const { return toNodes(topIds()); }
+        std::vector<NodePtr> bottom() const { return toNodes(bottomIds()); }
+        // Materializes every edge; prefer edgeRange() when just scanning.
+        std::vector<Edge> edges() const;
+        EdgeRange<NodeType> edgeRange() const { return {m_adj.data(), m_nodes.data(), m_labels.data(), static_cast<NodeId>(size())}; }
+        std::vector<NodePtr> inbound(const NodePtr& node) const;
+        std::vector<NodePtr> outbound(const NodePtr& node) const;
+        NeighborRange<NodeType> inboundView(const NodePtr& node) const { return inboundView(m_ids.at(node.get(), size())); }
+        NeighborRange<NodeType> outboundView(const NodePtr& node) const { return outboundView(m_ids.at(node.get(), size())); }
+        NeighborRange<NodeType> inboundView(NodeId id) const { return {m_adj[id].inbound, m_nodes.data()}; }
+        NeighborRange<NodeType> outboundView(NodeId id) const { return {m_adj[id].outbound, m_nodes.data()}; }
+        std::optional<NodeId> id(const NodePtr& node) const { return m_ids.find(node.get(), size()); }
+        const NodeType& get(NodeId id) const { return *static_cast<const NodeType*>(m_nodes[id]); }
+        NodePtr node(NodeId id) const { return NodePtr(m_arena, static_cast<NodeType*>(m_nodes[id])); }
+        const std::shared_ptr<StringInterner>& names() const { return m_arena->names(); }
+        BasicCompactDirectedGraph<NodeData> freeze() const;
+        // The DAG of strongly connected components: node c holds the member ids
+        // of component c and is named after its first member.
+        std::unique_ptr<BasicDirectedGraph<std::vector<NodeId>>> condense() const;
+};
+
+template <typename NodeData>
+std::vector<typename BasicDirectedGraph<NodeData>::NodePtr> BasicDirectedGraph<NodeData>::nodes() const {
+    std::vector<NodePtr> nodes;
+    nodes.reserve(size());
+    for (NodeId id = 0; id < size(); ++id) {
+        nodes.push_back(node(id));
+    }
+    return nodes;
+}
+
+template <typename NodeData>
+std::vector<BasicDirectedEdge<NodeData>> BasicDirectedGraph<NodeData>::edges() const {
+    std::vector<Edge> edges;
+    for (const auto& edge: edgeRange()) {
+        edges.push_back({node(edge.from_id), node(edge.to_id), std::string(edge.label)});
+    }
+    return edges;
+}
+
+template <typename NodeData>
+std::vector<typename BasicDirectedGraph<NodeData>::NodePtr> BasicDirectedGraph<NodeData>::inbound(const NodePtr& node) const {
+    std::vector<NodePtr> nodes;
+    for (const Neighbor& in: m_adj[m_ids.at(node.get(), size())].inbound) {
+        nodes.push_back(this->node(in.node));
+    }
+    return nodes;
+}
+
+template <typename NodeData>
+std::vector<typename BasicDirectedGraph<NodeData>::NodePtr> BasicDirectedGraph<NodeData>::outbound(const NodePtr& node) const {
+    std::vector<NodePtr> nodes;
+    for (const Neighbor& out: m_adj[m_ids.at(node.get(), size())].outbound) {
+        nodes.push_back(this->node(out.node));
+    }
+    return nodes;
+}
+
+struct BuilderEdge {
+    NodeId from;
+    NodeId to;
+    std::string label;
+};
+
+// Edges collected before a graph is built, with labels numbered locally.
+class EdgeBuffer {
+    protected:
+        struct PendingEdge {
+            NodeId from;
+            NodeId to;
+            uint32_t label;
+        };
+        size_t m_num_nodes;
+        std::vector<PendingEdge> m_edges;
+        std::vector<std::string> m_labels{std::string{}};
+        std::unordered_map<std::string, uint32_t> m_label_ids;
+        EdgeBuffer(size_t num_nodes): m_num_nodes(num_nodes) {}
+        uint32_t labelId(const std::string& label);
+        // Moves other's edges over, renumbering its labels into this buffer's.
+        void append(EdgeBuffer&& other);
+    public:
+        size_t size() const { return m_num_nodes; }
+        void reserveEdges(size_t num_edges) { m_edges.reserve(num_edges); }
+        void addEdge(NodeId from, NodeId to);
+        void addEdge(NodeId from, NodeId to, const std::string& label);
+        void addEdges(const std::vector<BuilderEdge>& edges);
+};
+
+class GraphBuilderBase: public EdgeBuffer {
+    protected:
+        std::string m_name;
+        bool m_built = false;
+        GraphBuilderBase(size_t num_nodes, const std::string& name);
+        void fill(GraphTopology& graph, const std::vector<NodeBase*>& nodes);
+};
+
+// Builds a DirectedGraph in one pass from a known node count and bulk edge
+// lists. Edges are bucketed by source, sorted and deduplicated in build(),
+// which fills the adjacency directly instead of going through addEdge. The
+// edges are consumed on the way, so a builder builds once; a second build()
+// throws. For parallel construction each thread takes a shard(), fills its
+// own node ids and edges there, and hands it back with merge(); shards share
+// nothing mutable, names included: each interns into its own table, which
+// merge() folds into the graph's.
+template <typename NodeData>
+class BasicGraphBuilder: public GraphBuilderBase {
+    std::shared_ptr<BasicNodeArena<NodeData>> m_arena;
+    std::vector<NodeBase*> m_nodes;
+    std::mutex m_merge_mutex;
+    public:
+        class Shard: public EdgeBuffer {
+            friend class BasicGraphBuilder;
+            std::vector<NodeBase*>* m_nodes;
+            std::shared_ptr<BasicNodeArena<NodeData>> m_arena;
+            Shard(std::vector<NodeBase*>& nodes):
+                    EdgeBuffer(nodes.size()), m_nodes(&nodes), m_arena(std::make_shared<BasicNodeArena<NodeData>>()) {}
+            public:
+                void setNode(NodeId id, const std::shared_ptr<BasicNode<NodeData>>& node) { m_nodes->at(id) = m_arena->adopt(node); }
+                void createNode(NodeId id, const NodeData& data) { m_nodes->at(id) = m_arena->create(data); }
+                void createNode(NodeId id, const NodeData& data, std::string_view name) { m_nodes->at(id) = m_arena->create(data, name); }
+        };
+        BasicGraphBuilder(size_t num_nodes): BasicGraphBuilder(num_nodes, std::string{"G"}) {}
+        BasicGraphBuilder(size_t num_nodes, const std::string& name):
+                GraphBuilderBase(num_nodes, name), m_arena(std::make_shared<BasicNodeArena<NodeData>>()), m_nodes(num_nodes, nullptr) {}
+        void setNode(NodeId id, const std::shared_ptr<BasicNode<NodeData>>& node) { m_nodes.at(id) = m_arena->adopt(node); }
+        void createNode(NodeId id, const NodeData& data) { m_nodes.at(id) = m_arena->create(data); }
+        void createNode(NodeId id, const NodeData& data, std::string_view name) { m_nodes.at(id) = m_arena->create(data, name); }
+        // Safe to call from several threads at once, as is merge().
+        Shard shard() { return Shard(m_nodes); }
+        void merge(Shard&& shard) {
+            std::lock_guard<std::mutex> lock(m_merge_mutex);
+            append(std::move(shard));
+            m_arena->names()->absorb(std::move(*shard.m_arena->names()));
+            m_arena->absorb(std::move(shard.m_arena));
+        }
+        std::unique_ptr<BasicDirectedGraph<NodeData>> build() {
+            auto graph = std::make_unique<BasicDirectedGraph<NodeData>>(m_name);
+            graph->m_arena = m_arena;
+            fill(*graph, m_nodes);
+            return graph;
+        }
+};
+
+template <typename NodeType>
+class CompactEdgeRange;
+
+// Immutable snapshot of a DirectedGraph with nodes renumbered to dense ids
+// and adjacency stored as compressed sparse rows.
+class CompactGraphTopology {
+    template <typename NodeType>
+    friend class CompactEdgeRange;
+    friend struct GraphTraits<CompactGraphTopology>;
+    protected:
+        std::string m_name;
+        std::vector<NodeBase*> m_nodes;
+        NodeIdMap m_ids; // the source graph's, as of the snapshot
+        std::vector<uint32_t> m_out_offsets;
+        std::vector<NodeId> m_out_targets;
+        std::vector<uint32_t> m_out_labels; // parallel to m_out_targets
+        std::vector<uint32_t> m_in_offsets;
+        std::vector<NodeId> m_in_targets;
+        std::vector<std::string> m_labels;
+    public:
+        CompactGraphTopology(const GraphTopology& graph);
+        const std::string& name() const { return m_name; }
+        size_t size() const { return m_nodes.size(); }
+        size_t numEdges() const { return m_out_targets.size(); }
+        std::optional<NodeId> id(const NodeBase* node) const;
+        std::string_view nodeName(NodeId id) const { return m_nodes[id]->name(); }
+        NodeIdRange inbound(NodeId id) const {
+            return {m_in_targets.data() + m_in_offsets[id], m_in_targets.data() + m_in_offsets[id + 1]};
+        }
+        NodeIdRange outbound(NodeId id) const {
+            return {m_out_targets.data() + m_out_offsets[id], m_out_targets.data() + m_out_offsets[id + 1]};
+        }
+        std::vector<NodeId> nodes_sorted() const;
+        TopologicalLevels levels(unsigned num_threads = 0) const;
+        StronglyConnectedComponents components() const;
+        std::vector<NodeId> findCycle() const;
+        std::vector<NodeId> top() const;
+        std::vector<NodeId> bottom() const;
+        const std::string& label(uint32_t label_id) const { return m_labels[label_id]; }
+};
+
+template <>
+struct GraphTraits<CompactGraphTopology> {
+    using NodeHandle = const NodeBase*;
+    static size_t idBound(const CompactGraphTopology& graph) { return graph.size(); }
+    static IdSequence nodes(const CompactGraphTopology& graph) { return graph.size(); }
+    static NodeIdRange inbound(const CompactGraphTopology& graph, NodeId id) { return graph.inbound(id); }
+    static NodeIdRange outbound(const CompactGraphTopology& graph, NodeId id) { return graph.outbound(id); }
+    static NodeHandle node(const CompactGraphTopology& graph, NodeId id) { return graph.m_nodes[id]; }
+    static std::string_view nodeName(const CompactGraphTopology& graph, NodeId id) { return graph.nodeName(id); }
+};
+
+// Edges of a compact graph leaving the given sources (every node when ids is
+// null), optionally restricted to targets in a member set.
+template <typename NodeType>
+class CompactEdgeRange {
+    const CompactGraphTopology* m_graph;
+    const NodeId* m_ids;
+    size_t m_count;
+    const NodeSet* m_members;
+    public:
+        class iterator {
+            const CompactEdgeRange* m_range;
+            size_t m_index;
+            NodeId m_node = 0;
+            uint32_t m_pos = 0;
+            uint32_t m_end = 0;
+            void load() {
+                if (m_index < m_range->m_count) {
+                    const CompactGraphTopology& graph = *m_range->m_graph;
+                    m_node = m_range->m_ids != nullptr ? m_range->m_ids[m_index] : static_cast<NodeId>(m_index);
+                    m_pos = graph.m_out_offsets[m_node];
+                    m_end = graph.m_out_offsets[m_node + 1];
+                }
+            }
+            void skip() {
+                const CompactGraphTopology& graph = *m_range->m_graph;
+                while (m_index < m_range->m_count) {
+                    for (; m_pos < m_end; ++m_pos) {
+                        if (m_range->m_members == nullptr || m_range->m_members->contains(graph.m_out_targets[m_pos])) {
+                            return;
+                        }
+                    }
+                    m_index++;
+                    load();
+                }
+            }
+            public:
+                using iterator_category = std::input_iterator_tag;
+                using value_type = EdgeRef<NodeType>;
+                using difference_type = std::ptrdiff_t;
+                using pointer = void;
+                using reference = EdgeRef<NodeType>;
+                iterator(const CompactEdgeRange* range, size_t index): m_range(range), m_index(index) {
+                    load();
+                    skip();
+                }
+                EdgeRef<NodeType> operator*() const {
+                    const CompactGraphTopology& graph = *m_range->m_graph;
+                    NodeId to = graph.m_out_targets[m_pos];
+                    return {m_node, to, *static_cast<const NodeType*>(graph.m_nodes[m_node]),
+                            *static_cast<const NodeType*>(graph.m_nodes[to]), graph.m_labels[graph.m_out_labels[m_pos]]};
+                }
+                iterator& operator++() {
+                    m_pos++;
+                    skip();
+                    return *this;
+                }
+                bool operator==(const iterator& other) const {
+                    return m_index == other.m_index && (m_index == m_range->m_count || m_pos == other.m_pos);
+                }
+                bool operator!=(const iterator& other) const { return !(*this == other); }
+        };
+        CompactEdgeRange(const CompactGraphTopology& graph, const NodeId* ids, size_t count, const NodeSet* members):
+                m_graph(&graph), m_ids(ids), m_count(count), m_members(members) {}
+        iterator begin() const { return {this, 0}; }
+        iterator end() const { return {this, m_count}; }
+};
+
+template <typename NodeData>
+class BasicCompactDirectedGraph: public CompactGraphTopology {
+    std::shared_ptr<BasicNodeArena<NodeData>> m_arena;
+    public:
+        using NodeType = BasicNode<NodeData>;
+        using NodePtr = std::shared_ptr<NodeType>;
+        BasicCompactDirectedGraph(const BasicDirectedGraph<NodeData>& graph): CompactGraphTopology(graph), m_arena(graph.m_arena) {}
+        bool hasNode(const NodePtr& node) const { return id(node.get()).has_value(); }
+        using CompactGraphTopology::id;
+        std::optional<NodeId> id(const NodePtr& node) const { return id(node.get()); }
+        const NodeType& get(NodeId id) const { return *static_cast<const NodeType*>(m_nodes[id]); }
+        NodePtr node(NodeId id) const { return NodePtr(m_arena, static_cast<NodeType*>(m_nodes[id])); }
+        const std::shared_ptr<StringInterner>& names() const { return m_arena->names(); }
+        CompactEdgeRange<NodeType> edgeRange() const { return {*this, nullptr, size(), nullptr}; }
+        std::vector<NodePtr> toNodes(const std::vector<NodeId>& ids) const {
+            std::vector<NodePtr> nodes;
+            nodes.reserve(ids.size());
+            for (NodeId id: ids) {
+                nodes.push_back(node(id));
+            }
+            return nodes;
+        }
+};
+
+template <typename NodeData>
+std::unique_ptr<BasicDirectedGraph<std::vector<NodeId>>> BasicDirectedGraph<NodeData>::condense() const {
+    StronglyConnectedComponents scc = components();
+    auto dag = std::make_unique<BasicDirectedGraph<std::vector<NodeId>>>(m_name, names());
+    dag->reserve(scc.size());
+    for (uint32_t c = 0; c < scc.size(); ++c) {
+        std::vector<NodeId> members(scc.members.begin() + scc.offsets[c], scc.members.begin() + scc.offsets[c + 1]);
+        dag->createNode(members, m_nodes[members.front()]->name());
+    }
+    for (const auto& edge: edgeRange()) {
+        uint32_t from = scc.component[edge.from_id];
+        uint32_t to = scc.component[edge.to_id];
+        if (from != to) {
+            dag->addEdge(from, to, std::string(edge.label));
+        }
+    }
+    return dag;
+}
+
+template <typename NodeData>
+BasicCompactDirectedGraph<NodeData> BasicDirectedGraph<NodeData>::freeze() const {
+    return BasicCompactDirectedGraph<NodeData>(*this);
+}
+
+template <typename NodeData>
+struct GraphTraits<BasicDirectedGraph<NodeData>>: GraphTraits<GraphTopology> {};
+
+template <typename NodeData>
+struct GraphTraits<BasicCompactDirectedGraph<NodeData>>: GraphTraits<CompactGraphTopology> {};
+
 enum class Direction {
     bi,
     in,
     out
 };
 
-class SubgraphExtractor {
+enum class TraversalOrder {
+    dfs,
+    bfs
+};
+
+struct TraversalOptions {
+    Direction direction = Direction::out;
+    TraversalOrder order = TraversalOrder::dfs;
+    // Hops from the nearest source along the traversal tree. Use bfs when
+    // this should be the shortest hop count.
+    uint32_t max_depth = std::numeric_limits<uint32_t>::max();
+};
+
+// Explicit-stack DFS/BFS over any graph with GraphTraits, a
+// CompactDirectedGraph by default. Nodes are visited at most once across all
+// run() calls until reset(), and nodes marked visited beforehand act as
+// barriers that are neither visited nor expanded.
+//
+// A GraphTraversal is meant to be kept around and reused: visited marks are
+// stamped with a generation counter so reset() is O(1), and the stack/queue
+// buffer keeps its capacity, so repeated runs do no heap allocation.
+template <typename Graph>
+class BasicGraphTraversal {
+    using Traits = GraphTraits<Graph>;
+    using NeighborIterator = decltype(Traits::outbound(std::declval<const Graph&>(), 0).begin());
+    // Direction::bi walks the inbound list, then the outbound one.
+    struct Frame {
+        NodeId node;
+        uint32_t depth;
+        bool outbound;
+        NeighborIterator next;
+        NeighborIterator end;
+    };
+    const Graph* m_graph;
+    std::vector<uint32_t> m_marks;
+    uint32_t m_epoch = 1;
+    std::vector<Frame> m_pending;
+    public:
+        BasicGraphTraversal(const Graph& graph): m_graph(&graph), m_marks(Traits::idBound(graph), 0) {}
+        const Graph& graph() const { return *m_graph; }
+        void bind(const Graph& graph) {
+            m_graph = &graph;
+            m_marks.assign(Traits::idBound(graph), 0);
+            m_epoch = 1;
+        }
+        void reset() {
+            if (++m_epoch == 0) {
+                std::fill(m_marks.begin(), m_marks.end(), 0);
+                m_epoch = 1;
+            }
+        }
+        bool markVisited(NodeId id) {
+            if (m_marks[id] == m_epoch) {
+                return false;
+            }
+            m_marks[id] = m_epoch;
+            return true;
+        }
+        bool visited(NodeId id) const { return m_marks[id] == m_epoch; }
+
+        // visit(NodeId, depth) is called once per newly reached node and may
+        // return false to stop the traversal. Returns false if stopped early.
+        template <typename Visitor>
+        bool run(const std::vector<NodeId>& sources, const TraversalOptions& options, Visitor&& visit) {
+            for (NodeId source: sources) {
+                if (!markVisited(source)) {
+                    continue;
+                }
+                if (!visit(source, 0)) {
+                    return false;
+                }
+                m_pending.clear();
+                m_pending.push_back(open(source, 0, options.direction));
+                bool completed = options.order == TraversalOrder::dfs ? depthFirst(options, visit) : breadthFirst(options, visit);
+                if (!completed) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        Frame open(NodeId node, uint32_t depth, Direction dir) const {
+            bool outbound = dir == Direction::out;
+            const auto& range = outbound ? Traits::outbound(*m_graph, node) : Traits::inbound(*m_graph, node);
+            return {node, depth, outbound, range.begin(), range.end()};
+        }
+
+        // Moves the frame to its next neighbor; false once both lists are done.
+        bool advance(Frame& frame, Direction dir, NodeId& next) const {
+            while (frame.next == frame.end) {
+                if (frame.outbound || dir != Direction::bi) {
+                    return false;
+                }
+                const auto& range = Traits::outbound(*m_graph, frame.node);
+                frame.outbound = true;
+                frame.next = range.begin();
+                frame.end = range.end();
+            }
+            next = *frame.next;
+            ++frame.next;
+            return true;
+        }
+
+        template <typename Visitor>
+        bool depthFirst(const TraversalOptions& options, Visitor& visit) {
+            while (!m_pending.empty()) {
+                Frame& frame = m_pending.back();
+                NodeId next;
+                if (frame.depth >= options.max_depth || !advance(frame, options.direction, next)) {
+                    m_pending.pop_back();
+                    continue;
+                }
+                if (!markVisited(next)) {
+                    continue;
+                }
+                uint32_t depth = frame.depth + 1;
+                if (!visit(next, depth)) {
+                    return false;
+                }
+                m_pending.push_back(open(next, depth, options.direction));
+            }
+            return true;
+        }
+
+        template <typename Visitor>
+        bool breadthFirst(const TraversalOptions& options, Visitor& visit) {
+            for (size_t head = 0; head < m_pending.size(); ++head) {
+                Frame frame = m_pending[head];
+                if (frame.depth >= options.max_depth) {
+                    continue;
+                }
+                for (NodeId next; advance(frame, options.direction, next);) {
+                    if (!markVisited(next)) {
+                        continue;
+                    }
+                    if (!visit(next, frame.depth + 1)) {
+                        return false;
+                    }
+                    m_pending.push_back(open(next, frame.depth + 1, options.direction));
+                }
+            }
+            return true;
+        }
+};
+
+using GraphTraversal = BasicGraphTraversal<CompactGraphTopology>;
+
+// The node selection behind extract(): everything reached forward from the
+// inputs without passing an output, plus everything reached backward from
+// the outputs without passing an input. Replaces nodes with the sorted ids.
+template <typename Graph>
+void collectSubgraph(BasicGraphTraversal<Graph>& outward, BasicGraphTraversal<Graph>& inward,
+        const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs, std::vector<NodeId>& nodes) {
+    outward.reset();
+    inward.reset();
+    nodes.clear();
+
+    for (NodeId id: outputs) {
+        if (outward.markVisited(id)) {
+            nodes.push_back(id);
+        }
+    }
+    outward.run(inputs, {Direction::out}, [&nodes](NodeId id, uint32_t) {
+        nodes.push_back(id);
+        return true;
+    });
+
+    for (NodeId id: inputs) {
+        inward.markVisited(id);
+    }
+    inward.run(outputs, {Direction::in}, [&nodes, &outward](NodeId id, uint32_t) {
+        if (!outward.visited(id)) {
+            nodes.push_back(id);
+        }
+        return true;
+    });
+
+    std::sort(nodes.begin(), nodes.end());
+}
+
+template <typename Graph>
+std::vector<NodeId> collectSubgraph(const Graph& graph, const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs) {
+    BasicGraphTraversal<Graph> outward(graph);
+    BasicGraphTraversal<Graph> inward(graph);
+    std::vector<NodeId> nodes;
+    collectSubgraph(outward, inward, inputs, outputs, nodes);
+    return nodes;
+}
+
+class WorkerPool;
+
+// Level-synchronous BFS over a frozen graph for graphs too large for one
+// thread. Each level is split across threads, and per level it either
+// expands the frontier (top-down) or lets every unvisited node look for a
+// parent in the frontier (bottom-up), whichever touches fewer edges.
+// Visited nodes live in an atomic bitmap that is kept between runs. Levels
+// run on one WorkerPool, which several traversals may share, and every
+// buffer is sized up front, so run() neither starts threads nor allocates.
+class ParallelBfs {
+    const CompactGraphTopology* m_graph;
+    std::shared_ptr<WorkerPool> m_pool;
+    std::vector<std::atomic<uint64_t>> m_visited;
+    std::vector<uint64_t> m_frontier_bits;
+    // each holds every node at most once per run, so neither ever grows
+    std::vector<NodeId> m_frontier;
+    std::vector<NodeId> m_next;
+    size_t m_frontier_size = 0;
+    size_t topDown(Direction direction);
+    size_t bottomUp(Direction direction);
+    public:
+        ParallelBfs(const CompactGraphTopology& graph, unsigned num_threads = 0);
+        ParallelBfs(const CompactGraphTopology& graph, std::shared_ptr<WorkerPool> pool);
+        const CompactGraphTopology& graph() const { return *m_graph; }
+        void reset();
+        bool markVisited(NodeId id) {
+            uint64_t bit = uint64_t{1} << (id % 64);
+            return !(m_visited[id / 64].fetch_or(bit, std::memory_order_relaxed) & bit);
+        }
+        bool visited(NodeId id) const { return (m_visited[id / 64].load(std::memory_order_relaxed) >> (id % 64)) & 1; }
+        uint64_t visitedWord(size_t word) const { return m_visited[word].load(std::memory_order_relaxed); }
+        void copyVisited(NodeSet& set) const {
+            set.reset(m_graph->size());
+            for (size_t word = 0; word < set.numWords(); ++word) {
+                set.words()[word] = visitedWord(word);
+            }
+        }
+        // Marks everything reachable from the sources. Nodes already marked,
+        // sources included, are neither reported again nor expanded.
+        void run(const std::vector<NodeId>& sources, Direction direction);
+};
+
+// Interval labels from one DFS over a frozen graph. The spanning forest's
+// pre/post numbers prove ancestry along tree edges, and on a DAG the
+// topological level, the post number and the lowest post number reachable
+// from a node rule out most other pairs, all in O(1). Pairs left open fall
+// back to a DFS pruned by the same labels. Costs five words per node.
+class AncestryLabels {
+    const CompactGraphTopology* m_graph;
+    std::vector<uint32_t> m_pre;
+    std::vector<uint32_t> m_post;
+    std::vector<uint32_t> m_low;
+    std::vector<uint32_t> m_level;
+    bool m_acyclic = true;
+    std::vector<uint32_t> m_marks;
+    uint32_t m_epoch = 0;
+    std::vector<NodeId> m_stack;
+    bool mayReach(NodeId from, NodeId to) const {
+        return !m_acyclic || (m_level[from] < m_level[to] && m_post[from] > m_post[to] && m_low[from] <= m_low[to]);
+    }
+    public:
+        AncestryLabels(const CompactGraphTopology& graph);
+        const CompactGraphTopology& graph() const { return *m_graph; }
+        bool acyclic() const { return m_acyclic; }
+        size_t memoryBytes() const;
+        // O(1) and conservative: true only for ancestors along tree edges.
+        bool treeAncestor(NodeId ancestor, NodeId descendant) const {
+            return m_pre[ancestor] < m_pre[descendant] && m_post[descendant] < m_post[ancestor];
+        }
+        // True if a non-empty path leads from ancestor to descendant.
+        bool isAncestor(NodeId ancestor, NodeId descendant);
+        // Label bounds over a set of targets, for mayReachAny().
+        struct Bounds {
+            uint32_t max_level = 0;
+            uint32_t min_post = std::numeric_limits<uint32_t>::max();
+            uint32_t max_low = 0;
+        };
+        Bounds bounds(const std::vector<NodeId>& targets, Bounds from) const;
+        Bounds bounds(const std::vector<NodeId>& targets) const { return bounds(targets, Bounds{}); }
+        // O(1) and conservative: false only if the node is none of the targets
+        // and no path leads from it to any of them. Always true on a cyclic graph.
+        bool mayReachAny(NodeId id, const Bounds& bounds) const {
+            return !m_acyclic || (m_level[id] <= bounds.max_level && m_post[id] >= bounds.min_post && m_low[id] <= bounds.max_low);
+        }
+};
+
+// Immediate dominators of a graph with dense ids (Cooper-Harvey-Kennedy).
+// By default nodes without predecessors hang off a virtual root, so graphs
+// with several sources work, and so does a cycle no source reaches.
+// Direction::in gives post-dominators, with a virtual exit behind every sink.
+class DominatorTree {
+    std::vector<NodeId> m_idom; // the virtual root is node size()
+    std::vector<uint32_t> m_pre;
+    std::vector<uint32_t> m_post;
+    template <typename Graph>
+    void build(const Graph& graph, Direction direction, const std::vector<NodeId>* entries);
+    void numberTree();
+    public:
+        static constexpr NodeId kRoot = std::numeric_limits<NodeId>::max();
+        template <typename Graph>
+        DominatorTree(const Graph& graph, Direction direction = Direction::out) {
+            build(graph, direction, nullptr);
+        }
+        // Only the given entries hang off the virtual root. Nodes none of them
+        // reaches, such as constants feeding the graph from the side, are
+        // dominated by the root alone and ignored as predecessors.
+        template <typename Graph>
+        DominatorTree(const Graph& graph, Direction direction, const std::vector<NodeId>& entries) {
+            build(graph, direction, &entries);
+        }
+        size_t size() const { return m_idom.size() - 1; }
+        // kRoot when only the virtual root dominates the node
+        NodeId idom(NodeId id) const {
+            NodeId parent = m_idom.at(id);
+            return parent == size() ? kRoot : parent;
+        }
+        // Reflexive, O(1) from the dominator tree's pre/post numbers.
+        bool dominates(NodeId a, NodeId b) const { return m_pre.at(a) <= m_pre.at(b) && m_post[b] <= m_post[a]; }
+};
+
+template <typename Graph>
+void DominatorTree::build(const Graph& graph, Direction direction, const std::vector<NodeId>* entries) {
+    using Traits = GraphTraits<Graph>;
+    const NodeId root = Traits::idBound(graph);
+    m_idom.assign(root + 1, kRoot);
+    m_pre.assign(root + 1, 0);
+    m_post.assign(root + 1, 0);
+    auto successors = [&](NodeId id) { return direction == Direction::in ? Traits::inbound(graph, id) : Traits::outbound(graph, id); };
+    auto predecessors = [&](NodeId id) { return direction == Direction::in ? Traits::outbound(graph, id) : Traits::inbound(graph, id); };
+
+    // postorder numbers from the virtual root
+    constexpr uint32_t kUnvisited = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> post(root + 1, kUnvisited);
+    std::vector<bool> entry(root, false);
+    std::vector<NodeId> reverse_post;
+    reverse_post.reserve(root);
+    using Iterator = decltype(successors(0).begin());
+    struct Frame {
+        NodeId node;
+        Iterator next;
+        Iterator end;
+    };
+    std::vector<Frame> frames;
+    auto push = [&](NodeId id) {
+        auto next = successors(id);
+        post[id] = 0; // visited, numbered when it finishes
+        frames.push_back({id, next.begin(), next.end()});
+    };
+    uint32_t counter = 0;
+    auto visit_from = [&](NodeId start) {
+        entry[start] = true;
+        if (post[start] != kUnvisited) {
+            return;
+        }
+        push(start);
+        while (!frames.empty()) {
+            Frame& frame = frames.back();
+            if (frame.next != frame.end) {
+                NodeId id = *frame.next;
+                ++frame.next;
+                if (post[id] == kUnvisited) {
+                    push(id);
+                }
+                continue;
+            }
+            post[frame.node] = counter++;
+            reverse_post.push_back(frame.node);
+            frames.pop_back();
+        }
+    };
+    if (entries != nullptr) {
+        for (NodeId id: *entries) {
+            visit_from(id);
+        }
+    }
+    else {
+        for (NodeId id = 0; id < root; ++id) {
+            if (emptyRange(predecessors(id))) {
+                visit_from(id);
+            }
+        }
+        // nodes no entry reaches become entries themselves
+        for (NodeId id = 0; id < root; ++id) {
+            if (post[id] == kUnvisited) {
+                visit_from(id);
+            }
+        }
+    }
+    post[root] = counter;
+    std::reverse(reverse_post.begin(), reverse_post.end());
+
+    auto intersect = [&](NodeId a, NodeId b) {
+        while (a != b) {
+            while (post[a] < post[b]) {
+                a = m_idom[a];
+            }
+            while (post[b] < post[a]) {
+                b = m_idom[b];
+            }
+        }
+        return a;
+    };
+    m_idom[root] = root;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (NodeId id: reverse_post) {
+            NodeId idom = entry[id] ? root : kRoot;
+            for (NodeId pred: predecessors(id)) {
+                if (m_idom[pred] != kRoot) {
+                    idom = idom == kRoot ? pred : intersect(pred, idom);
+                }
+            }
+            if (m_idom[id] != idom) {
+                m_idom[id] = idom;
+                changed = true;
+            }
+        }
+    }
+    numberTree();
+}
+
+// A block entered only through entry and left only through exit: entry
+// dominates every node in it and exit post-dominates every node in it.
+struct SeseRegion {
+    NodeId entry;
+    NodeId exit;
+};
+
+// Regions are plain ids, so one taken from another graph must not index
+// past this one's nodes.
+inline void checkRegion(const SeseRegion& region, size_t num_nodes) {
+    if (region.entry >= num_nodes || region.exit >= num_nodes) {
+        throw std::runtime_error("Region: " + std::to_string(region.entry) + " -> " + std::to_string(region.exit) + " not present in graph");
+    }
+}
+
+// Single-entry/single-exit regions from the dominator and post-dominator
+// trees. A fork's region ends at its immediate post-dominator, provided the
+// fork dominates it; anything else reaching that join from outside breaks
+// the region.
+class RegionFinder {
+    DominatorTree m_dominators;
+    DominatorTree m_post_dominators;
+    NodeSet m_forks; // nodes with more than one successor
+    template <typename Graph>
+    static NodeSet forks(const Graph& graph) {
+        using Traits = GraphTraits<Graph>;
+        NodeSet forks(Traits::idBound(graph));
+        for (NodeId id: Traits::nodes(graph)) {
+            auto next = Traits::outbound(graph, id);
+            auto iter = next.begin();
+            if (iter != next.end() && ++iter != next.end()) {
+                forks.insert(id);
+            }
+        }
+        return forks;
+    }
+    std::optional<SeseRegion> regionAt(NodeId entry) const;
+    public:
+        template <typename Graph>
+        RegionFinder(const Graph& graph):
+                m_dominators(graph, Direction::out), m_post_dominators(graph, Direction::in), m_forks(forks(graph)) {}
+        // Regions as seen from the given entries and exits only; see
+        // DominatorTree for what happens to nodes off their paths.
+        template <typename Graph>
+        RegionFinder(const Graph& graph, const std::vector<NodeId>& entries, const std::vector<NodeId>& exits):
+                m_dominators(graph, Direction::out, entries), m_post_dominators(graph, Direction::in, exits), m_forks(forks(graph)) {}
+        const DominatorTree& dominators() const { return m_dominators; }
+        const DominatorTree& postDominators() const { return m_post_dominators; }
+        // Every region opened by a node with more than one successor, in
+        // entry id order; nested blocks each get their own region.
+        std::vector<SeseRegion> regions() const;
+        // The innermost region containing the node, if any.
+        std::optional<SeseRegion> smallestRegion(NodeId id) const;
+};
+
+// Descendant bitsets over a frozen DAG for repeated reachability queries.
+// Every node gets a slot from its topological position and keeps the set of
+// slots it can reach. When the memory budget covers one bit per node the
+// bitsets are the exact transitive closure; otherwise runs of consecutive
+// positions share a bit, a clear bit still rules a node out and a set bit is
+// confirmed by a DFS pruned with the same bitsets.
+class ReachabilityIndex {
+    const CompactGraphTopology* m_graph;
+    std::vector<uint32_t> m_position;
+    size_t m_words;
+    std::vector<uint64_t> m_bits; // m_words per node
+    std::vector<uint32_t> m_marks;
+    uint32_t m_epoch = 0;
+    std::vector<NodeId> m_stack;
+    std::vector<uint64_t> m_targets;
+    std::vector<uint32_t> m_target_words;
+    std::vector<NodeId> m_between;
+    uint32_t slot(NodeId id) const { return uint64_t{m_position[id]} * (m_words * 64) / m_position.size(); }
+    bool hasSlot(NodeId id, uint32_t slot) const { return (m_bits[id * m_words + slot / 64] >> (slot % 64)) & 1; }
+    uint32_t nextEpoch();
+    public:
+        static constexpr size_t kDefaultMemoryBudget = size_t{64} << 20;
+        // Throws if the graph has a cycle.
+        ReachabilityIndex(const CompactGraphTopology& graph, size_t memory_budget = kDefaultMemoryBudget);
+        const CompactGraphTopology& graph() const { return *m_graph; }
+        bool exact() const { return m_words * 64 >= m_position.size(); }
+        size_t memoryBytes() const;
+        // True if a non-empty path leads from ancestor to descendant.
+        bool isAncestor(NodeId ancestor, NodeId descendant);
+        // Nodes on some path from an input to an output, endpoints included,
+        // sorted by id. Valid until the next call.
+        const std::vector<NodeId>& between(const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs);
+};
+
+// Read-only subset of a CompactDirectedGraph: the parent snapshot plus a
+// membership bitmap over its node ids. Nothing is copied out of the parent,
+// and the view keeps the snapshot alive. materialize() builds a standalone
+// graph when one is actually needed.
+template <typename NodeData>
+class BasicSubgraphView {
     public:
-        SubgraphExtractor(DirectedGraph* graph);
-        std::unique_ptr<DirectedGraph> extract(const std::vector<PtrNode>& inputs, const std::vector<PtrNode>& outputs);
+        using CompactGraph = BasicCompactDirectedGraph<NodeData>;
+        using Graph = BasicDirectedGraph<NodeData>;
+        using NodeType = BasicNode<NodeData>;
+        using NodePtr = std::shared_ptr<NodeType>;
+        using Edge = BasicDirectedEdge<NodeData>;
     private:
-        void dfs(PtrNode node, std::unordered_set<PtrNode>& visited, Direction d);
-        void ensureNodesExist(const std::vector<PtrNode>& inputs, const std::vector<PtrNode>& outputs);
-        std::unique_ptr<DirectedGraph> cloneGraph(const std::unordered_set<PtrNode>& nodes) const;
-        DirectedGraph* m_graph;
+        std::shared_ptr<const CompactGraph> m_parent;
+        std::vector<NodeId> m_nodes; // sorted parent ids
+        NodeSet m_members;
+    public:
+        BasicSubgraphView(std::shared_ptr<const CompactGraph> parent, std::vector<NodeId> nodes):
+                m_parent(std::move(parent)), m_nodes(std::move(nodes)), m_members(m_parent->size(), m_nodes) {}
+        const CompactGraph& parent() const { return *m_parent; }
+        size_t size() const { return m_nodes.size(); }
+        bool empty() const { return m_nodes.empty(); }
+        bool contains(NodeId id) const { return m_members.contains(id); }
+        bool contains(const NodePtr& node) const {
+            auto id = m_parent->id(node);
+            return id.has_value() && contains(id.value());
+        }
+        const std::vector<NodeId>& ids() const { return m_nodes; }
+        const NodeSet& nodeSet() const { return m_members; }
+        const NodeType& get(NodeId id) const { return m_parent->get(id); }
+        NodePtr node(NodeId id) const { return m_parent->node(id); }
+        std::vector<NodePtr> nodes() const { return m_parent->toNodes(m_nodes); }
+        std::vector<NodeId> topIds() const { return ::topIds(*this); }
+        std::vector<NodeId> bottomIds() const { return ::bottomIds(*this); }
+        std::vector<NodeId> sortedIds() const { return ::sortedIds(*this); }
+        std::vector<NodePtr> top() const { return m_parent->toNodes(topIds()); }
+        std::vector<NodePtr> bottom() const { return m_parent->toNodes(bottomIds()); }
+        std::vector<NodePtr> nodes_sorted() const { return m_parent->toNodes(sortedIds()); }
+        std::vector<Edge> edges() const;
+        // Edges between members, streamed without allocating.
+        CompactEdgeRange<NodeType> edgeRange() const { return {*m_parent, m_nodes.data(), m_nodes.size(), &m_members}; }
+        std::unique_ptr<Graph> materialize() const;
+};
+
+// A view is a graph in its own right: its members, with the edges between them.
+template <typename NodeData>
+struct GraphTraits<BasicSubgraphView<NodeData>> {
+    using View = BasicSubgraphView<NodeData>;
+    using NodeHandle = const BasicNode<NodeData>*;
+    static size_t idBound(const View& view) { return view.parent().size(); }
+    static const std::vector<NodeId>& nodes(const View& view) { return view.ids(); }
+    static MemberRange<NodeIdRange> inbound(const View& view, NodeId id) { return {view.parent().inbound(id), &view.nodeSet()}; }
+    static MemberRange<NodeIdRange> outbound(const View& view, NodeId id) { return {view.parent().outbound(id), &view.nodeSet()}; }
+    static NodeHandle node(const View& view, NodeId id) { return &view.get(id); }
+    static std::string_view nodeName(const View& view, NodeId id) { return view.get(id).name(); }
+};
+
+template <typename NodeData>
+std::vector<BasicDirectedEdge<NodeData>> BasicSubgraphView<NodeData>::edges() const {
+    std::vector<Edge> edges;
+    for (const auto& edge: edgeRange()) {
+        edges.push_back({node(edge.from_id), node(edge.to_id), std::string(edge.label)});
+    }
+    return edges;
+}
+
+// Copies the selected nodes and the edges between them into a new graph that
+// shares the parent's name interner. The names are already there, so this
+// only reads the interner.
+template <typename NodeData>
+std::unique_ptr<BasicDirectedGraph<NodeData>> BasicSubgraphView<NodeData>::materialize() const {
+    auto graph = std::make_unique<Graph>("subgraph", m_parent->names());
+    graph->reserve(m_nodes.size());
+    std::vector<NodeId> clone_map(m_parent->size(), std::numeric_limits<NodeId>::max());
+    for (NodeId id: m_nodes) {
+        const NodeType& node = get(id);
+        clone_map[id] = graph->createNode(node.data(), node.name());
+    }
+    for (const auto& edge: edgeRange()) {
+        graph->addEdge(clone_map[edge.from_id], clone_map[edge.to_id], std::string(edge.label));
+    }
+    return graph;
+}
+
+// Payload-independent half of the extractor: the reusable traversal
+// workspaces and the node selection itself.
+class SubgraphExtractorBase {
+    public:
+        static constexpr size_t kNoParallelism = std::numeric_limits<size_t>::max();
+        // Off by default. Once set, graphs with at least min_nodes nodes are
+        // swept with ParallelBfs; num_threads = 0 uses every hardware thread.
+        // The threads persist, so extractNodes() stays allocation-free.
+        void setParallelism(size_t min_nodes, unsigned num_threads = 0) {
+            m_parallel_threshold = min_nodes;
+            m_num_threads = num_threads;
+            m_parallel_outward.reset();
+            m_parallel_inward.reset();
+            m_pool.reset();
+        }
+    protected:
+        std::unique_ptr<GraphTraversal> m_outward;
+        std::unique_ptr<GraphTraversal> m_inward;
+        std::vector<NodeId> m_subgraph_nodes;
+        std::unique_ptr<ReachabilityIndex> m_reachability;
+        size_t m_reachability_budget = ReachabilityIndex::kDefaultMemoryBudget;
+        std::unique_ptr<AncestryLabels> m_ancestry;
+        std::unique_ptr<RegionFinder> m_regions;
+        std::unique_ptr<ParallelBfs> m_parallel_outward;
+        std::unique_ptr<ParallelBfs> m_parallel_inward;
+        std::shared_ptr<WorkerPool> m_pool;
+        NodeSet m_outward_set;
+        NodeSet m_inward_set;
+        BoundarySweep m_boundary;
+        size_t m_parallel_threshold = kNoParallelism;
+        unsigned m_num_threads = 0;
+        const std::vector<NodeId>& collectNodes(const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs);
+        const std::vector<NodeId>& collectNodesParallel(const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs);
+        // Throws if an output is not reachable from any input, or if two
+        // inputs (or two outputs) lie on one path. One sweep per side, pruned
+        // by the ancestry labels, so never worse than O(V+E).
+        void checkBoundary(const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs);
 };
 
+template <typename NodeData>
+class BasicSubgraphExtractor: public SubgraphExtractorBase {
+    public:
+        using Graph = BasicDirectedGraph<NodeData>;
+        using CompactGraph = BasicCompactDirectedGraph<NodeData>;
+        using NodePtr = typename Graph::NodePtr;
+        using View = BasicSubgraphView<NodeData>;
+        // Only reads the graph. The extractor keeps its traversal state, so
+        // give each thread its own; extractors over one frozen snapshot are
+        // cheap and share it.
+        BasicSubgraphExtractor(const Graph* graph): m_graph(graph), m_compact(nullptr) {}
+        // The compact graph is not owned and must outlive any view extracted from it.
+        BasicSubgraphExtractor(const CompactGraph* graph): m_graph(nullptr), m_compact(graph, [](const CompactGraph*) {}) {}
+        View extract(const std::vector<NodePtr>& inputs, const std::vector<NodePtr>& outputs) {
+            compactGraph();
+            std::vector<NodeId> input_ids = ensureNodesExist(inputs);
+            std::vector<NodeId> output_ids = ensureNodesExist(outputs);
+            checkBoundary(input_ids, output_ids);
+            const auto& nodes = collectNodes(input_ids, output_ids);
+            return View(m_compact != nullptr ? m_compact : m_frozen, nodes);
+        }
+        // Only the nodes lying on an input-to-output path, answered from the
+        // reachability index instead of two full traversals.
+        View extractBetween(const std::vector<NodePtr>& inputs, const std::vector<NodePtr>& outputs) {
+            ReachabilityIndex& index = reachability();
+            const auto& nodes = index.between(ensureNodesExist(inputs), ensureNodesExist(outputs));
+            return View(m_compact != nullptr ? m_compact : m_frozen, nodes);
+        }
+        // Built on first use and rebuilt after the graph changes.
+        ReachabilityIndex& reachability() {
+            compactGraph();
+            if (!m_reachability) {
+                m_reachability = std::make_unique<ReachabilityIndex>(snapshot(), m_reachability_budget);
+            }
+            return *m_reachability;
+        }
+        void setReachabilityBudget(size_t memory_budget) {
+            m_reachability_budget = memory_budget;
+            m_reachability.reset();
+        }
+        // Built on first use and rebuilt after the graph changes.
+        const RegionFinder& regions() {
+            compactGraph();
+            if (!m_regions) {
+                m_regions = std::make_unique<RegionFinder>(snapshot());
+            }
+            return *m_regions;
+        }
+        View extractRegion(const SeseRegion& region) {
+            checkRegion(region, compactGraph().size());
+            const auto& nodes = collectNodes({region.entry}, {region.exit});
+            return View(m_compact != nullptr ? m_compact : m_frozen, nodes);
+        }
+        // The innermost single-entry/single-exit block around the node.
+        View extractRegion(const NodePtr& node) {
+            compactGraph();
+            NodeId id = ensureNodesExist({node}).front();
+            auto region = regions().smallestRegion(id);
+            if (!region.has_value()) {
+                throw std::runtime_error("Node: " + std::string(node->name()) + " is not inside a single-entry/single-exit region");
+            }
+            return extractRegion(region.value());
+        }
+        // The allocation-free entry point: once warm, serial or parallel, it
+        // fills and returns the extractor's own buffer, valid until the next
+        // call. Boundaries are not checked. extract() and the other entry
+        // points allocate the ids they resolve and the view they return.
+        const std::vector<NodeId>& extractNodes(const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs) {
+            compactGraph();
+            return collectNodes(inputs, outputs);
+        }
+        const CompactGraph& compactGraph() {
+            if (m_compact == nullptr && (!m_frozen || m_frozen_version != m_graph->version())) {
+                m_frozen = std::make_shared<const CompactGraph>(*m_graph);
+                m_frozen_version = m_graph->version();
+                m_outward.reset();
+                m_inward.reset();
+                m_reachability.reset();
+                m_ancestry.reset();
+                m_regions.reset();
+                m_parallel_outward.reset();
+                m_parallel_inward.reset();
+            }
+            if (!m_outward) {
+                m_outward = std::make_unique<GraphTraversal>(snapshot());
+                m_inward = std::make_unique<GraphTraversal>(snapshot());
+            }
+            return snapshot();
+        }
+    private:
+        const CompactGraph& snapshot() const { return m_compact != nullptr ? *m_compact : *m_frozen; }
+        std::vector<NodeId> ensureNodesExist(const std::vector<NodePtr>& nodes) const;
+        const Graph* m_graph;
+        std::shared_ptr<const CompactGraph> m_compact;
+        // shared with the views extracted from it, so re-freezing never invalidates them
+        std::shared_ptr<const CompactGraph> m_frozen;
+        uint64_t m_frozen_version = 0;
+};
+
+template <typename NodeData>
+std::vector<NodeId> BasicSubgraphExtractor<NodeData>::ensureNodesExist(const std::vector<NodePtr>& nodes) const {
+    const CompactGraph& graph = snapshot();
+    std::vector<NodeId> ids;
+    ids.reserve(nodes.size());
+    for (const NodePtr& node: nodes) {
+        auto id = graph.id(node);
+        if (!id.has_value()) {
+            throw std::runtime_error("Node: " + std::string(node->name()) + " not present in graph");
+        }
+        ids.push_back(id.value());
+    }
+    return ids;
+}
+
+// Untyped graph whose nodes carry an arbitrary std::any payload.
+using Node = BasicNode<std::any>;
+using PtrNode = std::shared_ptr<Node>;
+using NodeArena = BasicNodeArena<std::any>;
+using DirectedEdge = BasicDirectedEdge<std::any>;
+using DirectedGraph = BasicDirectedGraph<std::any>;
+using GraphBuilder = BasicGraphBuilder<std::any>;
+using CompactDirectedGraph = BasicCompactDirectedGraph<std::any>;
+using SubgraphView = BasicSubgraphView<std::any>;
+using SubgraphExtractor = BasicSubgraphExtractor<std::any>;
+
+extern template class BasicDirectedGraph<std::any>;
+extern template class BasicGraphBuilder<std::any>;
+extern template class BasicCompactDirectedGraph<std::any>;
+extern template class BasicSubgraphView<std::any>;
+extern template class BasicSubgraphExtractor<std::any>;
+
 #endif
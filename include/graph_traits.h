@@ -0,0 +1,410 @@
+#ifndef GRAPH_TRAITS_H
+#define GRAPH_TRAITS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "node_set.h"
+
+// Adapts an adjacency layout to the algorithms below. They are templates, so
+// every layout gets its own inlined copy instead of going through a common
+// interface. A specialization provides:
+//   using NodeHandle = ...;                     what node() hands out
+//   static size_t idBound(const Graph&);        every node id is below this
+//   static auto nodes(const Graph&);            ids of the graph's nodes, ascending
+//   static auto inbound(const Graph&, NodeId);  ranges of NodeId, both of one type
+//   static auto outbound(const Graph&, NodeId);
+//   static NodeHandle node(const Graph&, NodeId);
+//   static std::string_view nodeName(const Graph&, NodeId);
+template <typename Graph>
+struct GraphTraits;
+
+// The ids [0, n) of a graph whose nodes are numbered densely.
+class IdSequence {
+    NodeId m_end;
+    public:
+        class iterator {
+            NodeId m_id;
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = NodeId;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const NodeId*;
+                using reference = NodeId;
+                iterator(NodeId id): m_id(id) {}
+                NodeId operator*() const { return m_id; }
+                iterator& operator++() { ++m_id; return *this; }
+                bool operator==(const iterator& other) const { return m_id == other.m_id; }
+                bool operator!=(const iterator& other) const { return m_id != other.m_id; }
+        };
+        IdSequence(size_t size): m_end(static_cast<NodeId>(size)) {}
+        iterator begin() const { return {0}; }
+        iterator end() const { return {m_end}; }
+};
+
+// The ids of a parent range that belong to a member set.
+template <typename Range>
+class MemberRange {
+    using ParentIterator = decltype(std::declval<const Range&>().begin());
+    Range m_range;
+    const NodeSet* m_members;
+    public:
+        class iterator {
+            ParentIterator m_pos;
+            ParentIterator m_end;
+            const NodeSet* m_members;
+            void skip() {
+                while (m_pos != m_end && !m_members->contains(*m_pos)) {
+                    ++m_pos;
+                }
+            }
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = NodeId;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const NodeId*;
+                using reference = NodeId;
+                iterator(ParentIterator pos, ParentIterator end, const NodeSet* members): m_pos(pos), m_end(end), m_members(members) {
+                    skip();
+                }
+                NodeId operator*() const { return *m_pos; }
+                iterator& operator++() {
+                    ++m_pos;
+                    skip();
+                    return *this;
+                }
+                bool operator==(const iterator& other) const { return m_pos == other.m_pos; }
+                bool operator!=(const iterator& other) const { return m_pos != other.m_pos; }
+        };
+        MemberRange(Range range, const NodeSet* members): m_range(range), m_members(members) {}
+        iterator begin() const { return {m_range.begin(), m_range.end(), m_members}; }
+        iterator end() const { return {m_range.end(), m_range.end(), m_members}; }
+};
+
+// Strongly connected components, numbered in topological order of the
+// condensation: every edge between two components goes from a lower to a
+// higher component index.
+struct StronglyConnectedComponents {
+    std::vector<uint32_t> component; // indexed by NodeId
+    std::vector<NodeId> members;     // grouped by component, ascending within one
+    std::vector<uint32_t> offsets;   // component c is members[offsets[c], offsets[c + 1])
+    size_t size() const { return offsets.size() - 1; }
+    size_t componentSize(uint32_t c) const { return offsets[c + 1] - offsets[c]; }
+};
+
+template <typename Range>
+bool emptyRange(const Range& range) {
+    return range.begin() == range.end();
+}
+
+template <typename Graph, typename Traits = GraphTraits<Graph>>
+std::vector<NodeId> topIds(const Graph& graph) {
+    std::vector<NodeId> ids;
+    for (NodeId id: Traits::nodes(graph)) {
+        if (emptyRange(Traits::inbound(graph, id))) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+template <typename Graph, typename Traits = GraphTraits<Graph>>
+std::vector<NodeId> bottomIds(const Graph& graph) {
+    std::vector<NodeId> ids;
+    for (NodeId id: Traits::nodes(graph)) {
+        if (emptyRange(Traits::outbound(graph, id))) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+// Iterative Tarjan, so deep graphs cannot overflow the stack. Entries of
+// component for ids that are not nodes of the graph are unspecified.
+template <typename Graph, typename Traits = GraphTraits<Graph>>
+StronglyConnectedComponents stronglyConnectedComponents(const Graph& graph) {
+    using Iterator = decltype(Traits::outbound(graph, 0).begin());
+    constexpr uint32_t kUnvisited = std::numeric_limits<uint32_t>::max();
+    struct Frame {
+        NodeId node;
+        Iterator next;
+    };
+    size_t bound = Traits::idBound(graph);
+    std::vector<uint32_t> index(bound, kUnvisited);
+    std::vector<uint32_t> low(bound, 0);
+    std::vector<bool> on_stack(bound, false);
+    std::vector<NodeId> stack;
+    std::vector<Frame> frames;
+    std::vector<uint32_t> finished(bound, 0);
+    std::vector<NodeId> members;
+    std::vector<uint32_t> ends;
+    uint32_t counter = 0;
+    auto enter = [&](NodeId id) {
+        index[id] = low[id] = counter++;
+        stack.push_back(id);
+        on_stack[id] = true;
+        frames.push_back({id, Traits::outbound(graph, id).begin()});
+    };
+    for (NodeId root: Traits::nodes(graph)) {
+        if (index[root] != kUnvisited) {
+            continue;
+        }
+        enter(root);
+        while (!frames.empty()) {
+            Frame& frame = frames.back();
+            NodeId id = frame.node;
+            if (frame.next != Traits::outbound(graph, id).end()) {
+                NodeId next = *frame.next;
+                ++frame.next;
+                if (index[next] == kUnvisited) {
+                    enter(next);
+                }
+                else if (on_stack[next]) {
+                    low[id] = std::min(low[id], index[next]);
+                }
+                continue;
+            }
+            frames.pop_back();
+            if (!frames.empty()) {
+                NodeId parent = frames.back().node;
+                low[parent] = std::min(low[parent], low[id]);
+            }
+            if (low[id] == index[id]) {
+                NodeId member;
+                do {
+                    member = stack.back();
+                    stack.pop_back();
+                    on_stack[member] = false;
+                    finished[member] = ends.size();
+                    members.push_back(member);
+                } while (member != id);
+                ends.push_back(members.size());
+            }
+        }
+    }
+    // Tarjan finishes sink components first; number them in reverse so every
+    // edge between components points forward
+    uint32_t num_components = ends.size();
+    StronglyConnectedComponents result;
+    result.members.reserve(members.size());
+    result.offsets.push_back(0);
+    for (uint32_t c = num_components; c-- > 0;) {
+        uint32_t begin = c == 0 ? 0 : ends[c - 1];
+        result.members.insert(result.members.end(), members.begin() + begin, members.begin() + ends[c]);
+        std::sort(result.members.end() - (ends[c] - begin), result.members.end());
+        result.offsets.push_back(result.members.size());
+    }
+    result.component.assign(bound, 0);
+    for (NodeId id: result.members) {
+        result.component[id] = num_components - 1 - finished[id];
+    }
+    return result;
+}
+
+// Shortest cycle through the first node of the first cyclic component, in
+// path order; the last node has an edge back to the first. Empty on a DAG.
+template <typename Graph, typename Traits = GraphTraits<Graph>>
+std::vector<NodeId> findCycle(const Graph& graph, const StronglyConnectedComponents& components) {
+    constexpr NodeId kNone = std::numeric_limits<NodeId>::max();
+    // shared by every component; the queue lists exactly the entries to reset
+    std::vector<NodeId> parent(Traits::idBound(graph), kNone);
+    std::vector<NodeId> queue;
+    for (uint32_t c = 0; c < components.size(); ++c) {
+        NodeId start = components.members[components.offsets[c]];
+        for (NodeId id: queue) {
+            parent[id] = kNone;
+        }
+        queue.assign(1, start);
+        parent[start] = start;
+        for (size_t head = 0; head < queue.size(); ++head) {
+            NodeId id = queue[head];
+            for (NodeId next: Traits::outbound(graph, id)) {
+                if (next == start) {
+                    std::vector<NodeId> cycle;
+                    for (NodeId at = id; at != start; at = parent[at]) {
+                        cycle.push_back(at);
+                    }
+                    cycle.push_back(start);
+                    std::reverse(cycle.begin(), cycle.end());
+                    return cycle;
+                }
+                if (components.component[next] == c && parent[next] == kNone) {
+                    parent[next] = id;
+                    queue.push_back(next);
+                }
+            }
+        }
+    }
+    return {};
+}
+
+template <typename Name>
+std::runtime_error cycleError(const std::vector<NodeId>& cycle, Name&& name) {
+    std::string message = "DirectedGraph contains a cycle:";
+    for (NodeId id: cycle) {
+        message += " ";
+        message += name(id);
+        message += " ->";
+    }
+    message += " ";
+    message += name(cycle.front());
+    return std::runtime_error(message);
+}
+
+template <typename Graph, typename Traits = GraphTraits<Graph>>
+std::runtime_error cycleError(const Graph& graph) {
+    return cycleError(findCycle<Graph, Traits>(graph, stronglyConnectedComponents<Graph, Traits>(graph)),
+            [&graph](NodeId id) { return Traits::nodeName(graph, id); });
+}
+
+// Kahn's algorithm. Throws with a cycle through the offending nodes.
+template <typename Graph, typename Traits = GraphTraits<Graph>>
+std::vector<NodeId> sortedIds(const Graph& graph) {
+    std::vector<uint32_t> in_degree(Traits::idBound(graph), 0);
+    std::vector<NodeId> sorted_ids;
+    size_t num_nodes = 0;
+    for (NodeId id: Traits::nodes(graph)) {
+        const auto& in = Traits::inbound(graph, id);
+        in_degree[id] = std::distance(in.begin(), in.end());
+        if (in_degree[id] == 0) {
+            sorted_ids.push_back(id);
+        }
+        num_nodes++;
+    }
+    for (size_t head = 0; head < sorted_ids.size(); ++head) {
+        for (NodeId next_id: Traits::outbound(graph, sorted_ids[head])) {
+            if (--in_degree[next_id] == 0) {
+                sorted_ids.push_back(next_id);
+            }
+        }
+    }
+    if (sorted_ids.size() < num_nodes) {
+        throw cycleError<Graph, Traits>(graph);
+    }
+    return sorted_ids;
+}
+
+// Sweeps forward from a set of sources and records, per node, up to two
+// distinct sources that reach it. That is enough to spot a source reached
+// from another one in O(V+E), cycles included: a node whose two slots are
+// taken still passes on a source other than any given one. Meant to be kept
+// by the caller: the owner table is sized once per graph and each run resets
+// only the entries the previous one touched.
+class BoundarySweep {
+    static constexpr NodeId kNone = std::numeric_limits<NodeId>::max();
+    std::vector<NodeId> m_owners; // two per node
+    std::vector<NodeId> m_touched;
+    std::vector<std::pair<NodeId, NodeId>> m_stack; // node, source it was reached from
+    bool claim(NodeId id, NodeId source) {
+        NodeId* slots = &m_owners[2 * id];
+        if (slots[0] == kNone) {
+            slots[0] = source;
+            m_touched.push_back(id);
+            return true;
+        }
+        if (slots[0] != source && slots[1] == kNone) {
+            slots[1] = source;
+            return true;
+        }
+        return false;
+    }
+    public:
+        // Nodes for which may_lead(id) is false are neither marked nor
+        // expanded. Returns the first (ancestor, descendant) pair of sources
+        // found; reached() answers for this run until the next one.
+        template <typename Graph, typename MayLead, typename Traits = GraphTraits<Graph>>
+        std::optional<std::pair<NodeId, NodeId>> run(const Graph& graph, const std::vector<NodeId>& sources, MayLead&& may_lead) {
+            size_t num_slots = 2 * Traits::idBound(graph);
+            if (m_owners.size() != num_slots) {
+                m_owners.assign(num_slots, kNone);
+                m_touched.clear();
+            }
+            for (NodeId id: m_touched) {
+                m_owners[2 * id] = kNone;
+                m_owners[2 * id + 1] = kNone;
+            }
+            m_touched.clear();
+            m_stack.clear();
+            for (NodeId source: sources) {
+                if (claim(source, source)) {
+                    m_stack.emplace_back(source, source);
+                }
+            }
+            std::optional<std::pair<NodeId, NodeId>> related;
+            while (!m_stack.empty()) {
+                auto [id, source] = m_stack.back();
+                m_stack.pop_back();
+                for (NodeId next: Traits::outbound(graph, id)) {
+                    // only a source owns itself
+                    if (m_owners[2 * next] == next && next != source && !related.has_value()) {
+                        related = std::make_pair(source, next);
+                    }
+                    if (may_lead(next) && claim(next, source)) {
+                        m_stack.emplace_back(next, source);
+                    }
+                }
+            }
+            return related;
+        }
+        bool reached(NodeId id) const { return m_owners[2 * id] != kNone; }
+};
+
+// The checks SubgraphExtractor::extract runs, done with one sweep per side
+// instead of ancestry labels, for graphs queried too rarely to index. Throws
+// if an output is not reachable from any input, or if two inputs (or two
+// outputs) lie on one path. Keep the sweep around between calls: each one
+// then resets only what the previous one marked.
+//
+// rank(id) must not decrease along any edge, e.g. a topological position.
+// A path between boundary nodes never ranks past its end, so each sweep
+// stops at nodes ranked above the boundary nodes it looks for and costs
+// about the window between them rather than the whole graph. A constant
+// rank prunes nothing.
+template <typename Graph, typename Rank, typename Traits = GraphTraits<Graph>>
+void validateBoundary(const Graph& graph, const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs,
+        BoundarySweep& sweep, Rank&& rank) {
+    auto name = [&graph](NodeId id) { return std::string(Traits::nodeName(graph, id)); };
+    auto max_rank = [&rank](const std::vector<NodeId>& ids, uint32_t from) {
+        for (NodeId id: ids) {
+            from = std::max<uint32_t>(from, rank(id));
+        }
+        return from;
+    };
+    uint32_t output_bound = max_rank(outputs, 0);
+    uint32_t boundary_bound = max_rank(inputs, output_bound);
+    auto below_boundary = [&](NodeId id) { return rank(id) <= boundary_bound; };
+    auto below_outputs = [&](NodeId id) { return rank(id) <= output_bound; };
+    if (auto related = sweep.run<Graph, decltype(below_boundary)&, Traits>(graph, inputs, below_boundary)) {
+        throw std::runtime_error("Input: " + name(related->first) + " is an ancestor of Input: " + name(related->second));
+    }
+    for (NodeId output: outputs) {
+        if (!sweep.reached(output)) {
+            throw std::runtime_error("Output: " + name(output) + " is not reachable from the inputs");
+        }
+    }
+    if (auto related = sweep.run<Graph, decltype(below_outputs)&, Traits>(graph, outputs, below_outputs)) {
+        throw std::runtime_error("Output: " + name(related->first) + " is an ancestor of Output: " + name(related->second));
+    }
+}
+
+template <typename Graph, typename Traits = GraphTraits<Graph>>
+void validateBoundary(const Graph& graph, const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs, BoundarySweep& sweep) {
+    validateBoundary<Graph, uint32_t (*)(NodeId), Traits>(graph, inputs, outputs, sweep, [](NodeId) { return uint32_t{0}; });
+}
+
+template <typename Graph, typename Traits = GraphTraits<Graph>>
+void validateBoundary(const Graph& graph, const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs) {
+    BoundarySweep sweep;
+    validateBoundary<Graph, Traits>(graph, inputs, outputs, sweep);
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef NODE_SET_H
+#define NODE_SET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using NodeId = uint32_t;
+
+// Set of node ids below a fixed universe size, stored as one bit per id.
+// Union, intersection and difference work a vector register at a time (AVX2
+// when compiled with it, else SSE2, else plain words).
+class NodeSet {
+    std::vector<uint64_t> m_words;
+    size_t m_universe = 0;
+
+    enum class Op {
+        unite,
+        intersect,
+        subtract
+    };
+    static uint64_t apply(Op op, uint64_t a, uint64_t b) {
+        return op == Op::unite ? a | b : op == Op::intersect ? a & b : a & ~b;
+    }
+    void combine(const NodeSet& other, Op op) {
+        if (other.m_universe != m_universe) {
+            throw std::runtime_error("NodeSet universes differ");
+        }
+        uint64_t* dst = m_words.data();
+        const uint64_t* src = other.m_words.data();
+        size_t n = m_words.size();
+        size_t i = 0;
+#if defined(__AVX2__)
+        for (; i + 4 <= n; i += 4) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i r = op == Op::unite ? _mm256_or_si256(a, b) : op == Op::intersect ? _mm256_and_si256(a, b) : _mm256_andnot_si256(b, a);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), r);
+        }
+#elif defined(__SSE2__)
+        for (; i + 2 <= n; i += 2) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i r = op == Op::unite ? _mm_or_si128(a, b) : op == Op::intersect ? _mm_and_si128(a, b) : _mm_andnot_si128(b, a);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), r);
+        }
+#endif
+        for (; i < n; ++i) {
+            dst[i] = apply(op, dst[i], src[i]);
+        }
+    }
+    public:
+        class Iterator {
+            const uint64_t* m_words;
+            size_t m_num_words;
+            size_t m_word;
+            uint64_t m_bits;
+            void skipEmpty() {
+                while (m_bits == 0 && m_word + 1 < m_num_words) {
+                    m_bits = m_words[++m_word];
+                }
+                if (m_bits == 0) {
+                    m_word = m_num_words;
+                }
+            }
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = NodeId;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const NodeId*;
+                using reference = NodeId;
+                Iterator(const uint64_t* words, size_t num_words, size_t word):
+                        m_words(words), m_num_words(num_words), m_word(word), m_bits(word < num_words ? words[word] : 0) {
+                    skipEmpty();
+                }
+                NodeId operator*() const { return static_cast<NodeId>(m_word * 64 + __builtin_ctzll(m_bits)); }
+                Iterator& operator++() {
+                    m_bits &= m_bits - 1;
+                    skipEmpty();
+                    return *this;
+                }
+                Iterator operator++(int) {
+                    Iterator prev = *this;
+                    ++*this;
+                    return prev;
+                }
+                bool operator==(const Iterator& other) const { return m_word == other.m_word && m_bits == other.m_bits; }
+                bool operator!=(const Iterator& other) const { return !(*this == other); }
+        };
+
+        NodeSet() = default;
+        explicit NodeSet(size_t universe): m_words((universe + 63) / 64, 0), m_universe(universe) {}
+        template <typename Ids>
+        NodeSet(size_t universe, const Ids& ids): NodeSet(universe) {
+            for (NodeId id: ids) {
+                insert(id);
+            }
+        }
+
+        size_t universe() const { return m_universe; }
+        size_t numWords() const { return m_words.size(); }
+        uint64_t* words() { return m_words.data(); }
+        const uint64_t* words() const { return m_words.data(); }
+
+        void insert(NodeId id) { m_words[id / 64] |= uint64_t{1} << (id % 64); }
+        void erase(NodeId id) { m_words[id / 64] &= ~(uint64_t{1} << (id % 64)); }
+        bool contains(NodeId id) const { return id < m_universe && ((m_words[id / 64] >> (id % 64)) & 1); }
+        void clear() { std::fill(m_words.begin(), m_words.end(), 0); }
+        // clears the set and changes the universe, reusing the storage
+        void reset(size_t universe) {
+            m_words.assign((universe + 63) / 64, 0);
+            m_universe = universe;
+        }
+
+        size_t count() const {
+            size_t total = 0;
+            for (uint64_t word: m_words) {
+                total += __builtin_popcountll(word);
+            }
+            return total;
+        }
+        bool empty() const {
+            for (uint64_t word: m_words) {
+                if (word != 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        NodeSet& operator|=(const NodeSet& other) {
+            combine(other, Op::unite);
+            return *this;
+        }
+        NodeSet& operator&=(const NodeSet& other) {
+            combine(other, Op::intersect);
+            return *this;
+        }
+        NodeSet& operator-=(const NodeSet& other) {
+            combine(other, Op::subtract);
+            return *this;
+        }
+        friend NodeSet operator|(NodeSet a, const NodeSet& b) { return a |= b; }
+        friend NodeSet operator&(NodeSet a, const NodeSet& b) { return a &= b; }
+        friend NodeSet operator-(NodeSet a, const NodeSet& b) { return a -= b; }
+        bool operator==(const NodeSet& other) const { return m_universe == other.m_universe && m_words == other.m_words; }
+        bool operator!=(const NodeSet& other) const { return !(*this == other); }
+
+        Iterator begin() const { return Iterator(m_words.data(), m_words.size(), 0); }
+        Iterator end() const { return Iterator(m_words.data(), m_words.size(), m_words.size()); }
+        // ids in increasing order
+        std::vector<NodeId> toVector() const {
+            std::vector<NodeId> ids;
+            appendTo(ids);
+            return ids;
+        }
+        void appendTo(std::vector<NodeId>& ids) const {
+            for (NodeId id: *this) {
+                ids.push_back(id);
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// 0 means one thread per hardware thread.
+inline unsigned resolveThreads(unsigned num_threads) {
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    return std::max(num_threads, 1u);
+}
+
+// Splits [0, count) into contiguous blocks and runs body(begin, end, block)
+// on each, the calling thread taking block 0. Each block gets at least
+// min_block items, so small inputs run inline without starting any thread.
+// Returns the number of blocks used.
+template <typename Body>
+unsigned parallelFor(size_t count, unsigned num_threads, size_t min_block, Body&& body) {
+    size_t max_blocks = std::max<size_t>(count / std::max<size_t>(min_block, 1), 1);
+    unsigned num_blocks = static_cast<unsigned>(std::min<size_t>(resolveThreads(num_threads), max_blocks));
+    if (num_blocks == 1) {
+        body(size_t{0}, count, 0u);
+        return 1;
+    }
+    size_t block_size = (count + num_blocks - 1) / num_blocks;
+    std::vector<std::thread> workers;
+    workers.reserve(num_blocks - 1);
+    for (unsigned block = 1; block < num_blocks; ++block) {
+        size_t begin = std::min(count, block * block_size);
+        size_t end = std::min(count, begin + block_size);
+        workers.emplace_back([&body, begin, end, block] { body(begin, end, block); });
+    }
+    body(size_t{0}, std::min(count, block_size), 0u);
+    for (auto& worker: workers) {
+        worker.join();
+    }
+    return num_blocks;
+}
+
+// A fixed set of threads for loops that run many short parallel steps, such
+// as one per BFS level, where starting and joining threads every step would
+// dominate. run() has parallelFor's contract and allocates nothing. One run()
+// at a time per pool.
+class WorkerPool {
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    uint64_t m_generation = 0;
+    bool m_stop = false;
+    // the current step, guarded by m_mutex
+    size_t m_count = 0;
+    size_t m_block_size = 0;
+    unsigned m_num_blocks = 0;
+    unsigned m_pending = 0;
+    void (*m_invoke)(void*, size_t, size_t, unsigned) = nullptr;
+    void* m_body = nullptr;
+    void work(unsigned block) {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_start.wait(lock, [&] { return m_stop || m_generation != seen; });
+            if (m_stop) {
+                return;
+            }
+            seen = m_generation;
+            if (block >= m_num_blocks) {
+                continue;
+            }
+            size_t begin = std::min(m_count, block * m_block_size);
+            size_t end = std::min(m_count, begin + m_block_size);
+            auto invoke = m_invoke;
+            void* body = m_body;
+            lock.unlock();
+            invoke(body, begin, end, block);
+            lock.lock();
+            if (--m_pending == 0) {
+                m_done.notify_one();
+            }
+        }
+    }
+    public:
+        explicit WorkerPool(unsigned num_threads = 0) {
+            unsigned num_workers = resolveThreads(num_threads) - 1;
+            m_workers.reserve(num_workers);
+            for (unsigned block = 1; block <= num_workers; ++block) {
+                m_workers.emplace_back([this, block] { work(block); });
+            }
+        }
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+        ~WorkerPool() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_start.notify_all();
+            for (auto& worker: m_workers) {
+                worker.join();
+            }
+        }
+        // threads available to run(), the caller's included
+        unsigned size() const { return m_workers.size() + 1; }
+
+        template <typename Body>
+        unsigned run(size_t count, size_t min_block, Body&& body) {
+            using BodyType = std::remove_reference_t<Body>;
+            size_t max_blocks = std::max<size_t>(count / std::max<size_t>(min_block, 1), 1);
+            unsigned num_blocks = static_cast<unsigned>(std::min<size_t>(size(), max_blocks));
+            if (num_blocks == 1) {
+                body(size_t{0}, count, 0u);
+                return 1;
+            }
+            size_t block_size = (count + num_blocks - 1) / num_blocks;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_count = count;
+                m_block_size = block_size;
+                m_num_blocks = num_blocks;
+                m_pending = num_blocks - 1;
+                m_invoke = [](void* body, size_t begin, size_t end, unsigned block) {
+                    (*static_cast<BodyType*>(body))(begin, end, block);
+                };
+                m_body = const_cast<void*>(static_cast<const void*>(std::addressof(body)));
+                m_generation++;
+            }
+            m_start.notify_all();
+            body(size_t{0}, std::min(count, block_size), 0u);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [this] { return m_pending == 0; });
+            return num_blocks;
+        }
+};
+
+#endif
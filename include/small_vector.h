@@ -0,0 +1,120 @@
+#ifndef SMALL_VECTOR_H
+#define SMALL_VECTOR_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+// Vector of trivially copyable elements that keeps up to N of them inline and
+// only spills to the heap when it grows past that.
+template <typename T, uint32_t N>
+class SmallVector {
+    static_assert(std::is_trivially_copyable_v<T>, "SmallVector only holds trivially copyable types");
+    static_assert(N > 0, "SmallVector needs at least one inline slot");
+    union {
+        T m_inline[N];
+        T* m_heap;
+    };
+    uint32_t m_size = 0;
+    uint32_t m_capacity = N;
+    public:
+        SmallVector() {}
+        SmallVector(const SmallVector& other) {
+            reserve(other.m_size);
+            std::memcpy(data(), other.data(), other.m_size * sizeof(T));
+            m_size = other.m_size;
+        }
+        SmallVector(SmallVector&& other) noexcept {
+            steal(other);
+        }
+        SmallVector& operator=(const SmallVector& other) {
+            if (this != &other) {
+                clear();
+                reserve(other.m_size);
+                std::memcpy(data(), other.data(), other.m_size * sizeof(T));
+                m_size = other.m_size;
+            }
+            return *this;
+        }
+        SmallVector& operator=(SmallVector&& other) noexcept {
+            if (this != &other) {
+                release();
+                steal(other);
+            }
+            return *this;
+        }
+        ~SmallVector() { release(); }
+
+        bool isInline() const { return m_capacity == N; }
+        uint32_t size() const { return m_size; }
+        uint32_t capacity() const { return m_capacity; }
+        bool empty() const { return m_size == 0; }
+        T* data() { return isInline() ? m_inline : m_heap; }
+        const T* data() const { return isInline() ? m_inline : m_heap; }
+        T* begin() { return data(); }
+        T* end() { return data() + m_size; }
+        const T* begin() const { return data(); }
+        const T* end() const { return data() + m_size; }
+        T& operator[](uint32_t i) { return data()[i]; }
+        const T& operator[](uint32_t i) const { return data()[i]; }
+        T& back() { return data()[m_size - 1]; }
+
+        void reserve(uint32_t capacity) {
+            if (capacity <= m_capacity) {
+                return;
+            }
+            T* heap = static_cast<T*>(std::malloc(capacity * sizeof(T)));
+            if (heap == nullptr) {
+                throw std::bad_alloc();
+            }
+            std::memcpy(heap, data(), m_size * sizeof(T));
+            release();
+            m_heap = heap;
+            m_capacity = capacity;
+        }
+
+        void push_back(const T& value) {
+            if (m_size == m_capacity) {
+                T copy = value; // value may live in the buffer being reallocated
+                reserve(m_capacity * 2);
+                data()[m_size++] = copy;
+                return;
+            }
+            data()[m_size++] = value;
+        }
+
+        void pop_back() { m_size--; }
+
+        T* erase(T* pos) {
+            std::memmove(pos, pos + 1, (end() - pos - 1) * sizeof(T));
+            m_size--;
+            return pos;
+        }
+
+        void clear() { m_size = 0; }
+
+    private:
+        void release() {
+            if (!isInline()) {
+                std::free(m_heap);
+                m_capacity = N;
+            }
+        }
+
+        void steal(SmallVector& other) {
+            if (other.isInline()) {
+                std::memcpy(m_inline, other.m_inline, other.m_size * sizeof(T));
+            }
+            else {
+                m_heap = other.m_heap;
+                m_capacity = other.m_capacity;
+                other.m_capacity = N;
+            }
+            m_size = other.m_size;
+            other.m_size = 0;
+        }
+};
+
+#endif
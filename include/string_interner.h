@@ -0,0 +1,127 @@
+#ifndef STRING_INTERNER_H
+#define STRING_INTERNER_H
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Stores each distinct string once, packed into large character blocks, and
+// hands out views that stay valid for the interner's lifetime.
+//
+// Not thread-safe, and needs no lock on the common single-threaded path.
+// Interning a string already present only reads, so graphs sharing an
+// interner may copy each other's nodes concurrently. Threads filling one
+// graph intern into interners of their own, which the owner folds in with
+// absorb(); see BasicGraphBuilder::Shard.
+class StringInterner {
+    static constexpr size_t kMinBlockSize = 1024;
+    static constexpr size_t kBlockSize = 64 * 1024;
+    static constexpr size_t kMinSlots = 16;
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    // no longer filled: large strings and storage taken over by absorb()
+    std::vector<std::unique_ptr<char[]>> m_sealed;
+    size_t m_block_size = 0;
+    size_t m_block_used = 0;
+    // open addressing with linear probing, at most 3/4 full; a null data()
+    // marks a free slot, so no entry costs an allocation of its own
+    std::vector<std::string_view> m_slots;
+    size_t m_size = 0;
+    public:
+        StringInterner() = default;
+        StringInterner(const StringInterner&) = delete;
+        StringInterner& operator=(const StringInterner&) = delete;
+
+        std::string_view intern(std::string_view str) {
+            if (!m_slots.empty()) {
+                std::string_view found = m_slots[slotFor(str)];
+                if (found.data() != nullptr) {
+                    return found;
+                }
+            }
+            reserveOne();
+            std::string_view& slot = m_slots[slotFor(str)];
+            slot = std::string_view(store(str), str.size());
+            m_size++;
+            return slot;
+        }
+
+        bool contains(std::string_view str) const {
+            return !m_slots.empty() && m_slots[slotFor(str)].data() != nullptr;
+        }
+
+        size_t size() const { return m_size; }
+
+        // Takes over the other interner's strings along with their storage,
+        // so views it handed out stay valid. A string both hold keeps this
+        // interner's copy as the canonical one. Leaves the other empty.
+        void absorb(StringInterner&& other) {
+            for (auto* blocks: {&other.m_blocks, &other.m_sealed}) {
+                std::move(blocks->begin(), blocks->end(), std::back_inserter(m_sealed));
+                blocks->clear();
+            }
+            for (std::string_view str: other.m_slots) {
+                if (str.data() == nullptr) {
+                    continue;
+                }
+                reserveOne();
+                std::string_view& slot = m_slots[slotFor(str)];
+                if (slot.data() == nullptr) {
+                    slot = str;
+                    m_size++;
+                }
+            }
+            other.m_slots.clear();
+            other.m_size = 0;
+            other.m_block_size = 0;
+            other.m_block_used = 0;
+        }
+
+    private:
+        // the string's slot, or the free slot it would take
+        size_t slotFor(std::string_view str) const {
+            size_t mask = m_slots.size() - 1;
+            for (size_t i = std::hash<std::string_view>{}(str) & mask;; i = (i + 1) & mask) {
+                if (m_slots[i].data() == nullptr || m_slots[i] == str) {
+                    return i;
+                }
+            }
+        }
+
+        void reserveOne() {
+            if (4 * (m_size + 1) <= 3 * m_slots.size()) {
+                return;
+            }
+            std::vector<std::string_view> old(std::max(kMinSlots, 2 * m_slots.size()));
+            old.swap(m_slots);
+            for (std::string_view str: old) {
+                if (str.data() != nullptr) {
+                    m_slots[slotFor(str)] = str;
+                }
+            }
+        }
+
+        const char* store(std::string_view str) {
+            if (str.size() > kBlockSize / 4) {
+                // large strings get their own allocation so they don't waste the current block
+                m_sealed.emplace_back(new char[str.size()]);
+                std::memcpy(m_sealed.back().get(), str.data(), str.size());
+                return m_sealed.back().get();
+            }
+            if (m_blocks.empty() || m_block_used + str.size() > m_block_size) {
+                // blocks start small and double, so small graphs stay small
+                m_block_size = std::max(std::min(m_block_size * 2, kBlockSize), std::max(kMinBlockSize, str.size()));
+                m_blocks.emplace_back(new char[m_block_size]);
+                m_block_used = 0;
+            }
+            char* dst = m_blocks.back().get() + m_block_used;
+            std::memcpy(dst, str.data(), str.size());
+            m_block_used += str.size();
+            return dst;
+        }
+};
+
+#endif
@@ -3,62 +3,160 @@
 
 #include "graph.h"
 #include "onnx.proto3.pb.h"
+#include <atomic>
 #include <filesystem>
+#include <mutex>
+#include <unordered_set>
 
 // NNModelSubgraphExtractor ex("/path/to/model.ext");
 // ex.extract({"i0"}, {"o1", "o2"}, "/path/to/output_model.ext");
 
+template <typename NodeData>
 class NNModel {
     public:
+        using Graph = BasicDirectedGraph<NodeData>;
         NNModel() = default;
-        NNModel(std::unique_ptr<DirectedGraph> graph): m_graph(std::move(graph)) {};
-        virtual DirectedGraph* graph() { return m_graph.get(); }
-        virtual void save(std::filesystem::path fpath) = 0;
+        NNModel(std::unique_ptr<Graph> graph): m_graph(std::move(graph)) {};
+        virtual Graph* graph() { return m_graph.get(); }
+        virtual void save(std::filesystem::path fpath) const = 0;
         virtual ~NNModel() = default;
     protected:
-        std::unique_ptr<DirectedGraph> m_graph;
+        std::unique_ptr<Graph> m_graph;
 };
 
-class OnnxModel: public NNModel {
+using OnnxGraph = BasicDirectedGraph<onnx::NodeProto>;
+
+// Neighbor queries straight over a GraphProto, with node indices as ids: an
+// edge runs from the producer of a value to each node consuming it. Only the
+// producer/consumer lists and a name index are built, nothing is copied out
+// of the proto, and the proto must outlive the adapter.
+class OnnxGraphAdapter {
+    static std::atomic<uint64_t> m_next_generation;
+    const onnx::GraphProto* m_graph;
+    uint64_t m_generation;
+    std::vector<uint32_t> m_in_offsets;
+    std::vector<NodeId> m_producers;
+    std::vector<uint32_t> m_out_offsets;
+    std::vector<NodeId> m_consumers;
+    // empty while the proto lists nodes in topological order, as ONNX requires
+    std::vector<uint32_t> m_rank;
+    std::unordered_map<std::string_view, NodeId> m_name_index;
+    public:
+        OnnxGraphAdapter(const onnx::GraphProto& graph);
+        OnnxGraphAdapter(const OnnxGraphAdapter&) = delete;
+        OnnxGraphAdapter& operator=(const OnnxGraphAdapter&) = delete;
+        // unique per adapter, so state bound to one can tell it from a later
+        // adapter at the same address
+        uint64_t generation() const { return m_generation; }
+        size_t size() const { return m_in_offsets.size() - 1; }
+        const onnx::NodeProto& node(NodeId id) const { return m_graph->node(id); }
+        NodeIdRange inbound(NodeId id) const { return {m_producers.data() + m_in_offsets[id], m_producers.data() + m_in_offsets[id + 1]}; }
+        NodeIdRange outbound(NodeId id) const { return {m_consumers.data() + m_out_offsets[id], m_consumers.data() + m_out_offsets[id + 1]}; }
+        // Grows along every edge: the node index for a proto in topological
+        // order, a computed order otherwise, and 0 throughout on a cycle.
+        uint32_t rank(NodeId id) const { return m_rank.empty() ? id : m_rank[id]; }
+        std::vector<NodeId> idsByName(const std::vector<std::string>& names) const;
+};
+
+template <>
+struct GraphTraits<OnnxGraphAdapter> {
+    using NodeHandle = const onnx::NodeProto*;
+    static size_t idBound(const OnnxGraphAdapter& graph) { return graph.size(); }
+    static IdSequence nodes(const OnnxGraphAdapter& graph) { return graph.size(); }
+    static NodeIdRange inbound(const OnnxGraphAdapter& graph, NodeId id) { return graph.inbound(id); }
+    static NodeIdRange outbound(const OnnxGraphAdapter& graph, NodeId id) { return graph.outbound(id); }
+    static NodeHandle node(const OnnxGraphAdapter& graph, NodeId id) { return &graph.node(id); }
+    static std::string_view nodeName(const OnnxGraphAdapter& graph, NodeId id) { return graph.node(id).name(); }
+};
+
+// Immutable once loaded: every const member may be called from any number
+// of threads at once. Lookups point into the loaded ModelProto instead of
+// copying out of it. The DirectedGraph is only built when graph() is first
+// called, once even under concurrent calls; extraction runs on the adapter.
+class OnnxModel: public NNModel<onnx::NodeProto> {
     public:
         OnnxModel(std::filesystem::path fpath);
         OnnxModel(std::unique_ptr<onnx::ModelProto> model_proto);
-        onnx::ValueInfoProto getValueInfo(const std::string& vinfo_name);
-        onnx::TensorProto getTensorProto(const std::string& tensor_name);
-        bool isConst(const std::string& node_name) const;
-        std::unique_ptr<onnx::ModelProto> makeModel(const std::vector<onnx::NodeProto>& nodes,
-                const std::vector<onnx::ValueInfoProto>& values,
+        OnnxGraph* graph() override;
+        const OnnxGraphAdapter& adapter() const { return *m_adapter; }
+        // nullptr when the model has no such value info or initializer
+        const onnx::ValueInfoProto* findValueInfo(std::string_view vinfo_name) const;
+        const onnx::TensorProto* findTensorProto(std::string_view tensor_name) const;
+        // Throw std::out_of_range when the name is unknown.
+        const onnx::ValueInfoProto& getValueInfo(const std::string& vinfo_name) const;
+        const onnx::TensorProto& getTensorProto(const std::string& tensor_name) const;
+        bool isConst(std::string_view node_name) const;
+        // Regions over the adapter's ids, built once on first use. Entries are
+        // the nodes reading a graph input, exits the sinks and the producers of
+        // graph outputs. Constants and whatever only they feed are side inputs:
+        // they neither open nor break a region.
+        const RegionFinder& regions() const;
+        bool isSideInput(NodeId id) const;
+        std::unique_ptr<onnx::ModelProto> makeModel(const std::vector<const onnx::NodeProto*>& nodes,
+                const std::vector<const onnx::ValueInfoProto*>& values,
                 const std::vector<onnx::ValueInfoProto>& inputs,
                 const std::vector<onnx::ValueInfoProto>& outputs,
-                const std::vector<onnx::TensorProto>& inits);
-        void save(std::filesystem::path fpath) override;
+                const std::vector<const onnx::TensorProto*>& inits) const;
+        void save(std::filesystem::path fpath) const override;
     private:
-        std::unique_ptr<DirectedGraph> convert(std::filesystem::path fpath);
-        std::unique_ptr<DirectedGraph> convert(std::unique_ptr<onnx::ModelProto> model_proto);
+        void index(std::unique_ptr<onnx::ModelProto> model_proto);
+        std::unique_ptr<OnnxGraph> convert() const;
         std::unique_ptr<onnx::ModelProto> load(std::filesystem::path fpath);
         std::unique_ptr<onnx::ModelProto> m_model_proto;
-        std::unordered_map<std::string, onnx::ValueInfoProto> m_vinfo_map;
-        std::unordered_map<std::string, onnx::TensorProto> m_init_map;
-        std::unordered_map<std::string, onnx::NodeProto> m_const_map;
-        
+        std::unique_ptr<OnnxGraphAdapter> m_adapter;
+        std::once_flag m_graph_once;
+        mutable std::once_flag m_regions_once;
+        mutable std::unique_ptr<RegionFinder> m_regions;
+        mutable NodeSet m_side_inputs;
+        // keys and values point into m_model_proto
+        std::unordered_map<std::string_view, const onnx::ValueInfoProto*> m_vinfo_map;
+        std::unordered_map<std::string_view, const onnx::TensorProto*> m_init_map;
+        std::unordered_set<std::string_view> m_const_nodes;
 };
 
+template <typename NodeData>
 class NNModelSubgraphExtractor {
     public:
-        NNModelSubgraphExtractor(std::shared_ptr<NNModel> model): m_sgex(SubgraphExtractor(model->graph())) {}
+        NNModelSubgraphExtractor() = default;
 //        NNModelSubgraphExtractor(std::filesystem::path model_path): NNModelSubgraphExtractor(load(model_path)){}
-        virtual std::unique_ptr<NNModel> extract(const std::vector<std::string>& inputs, const std::vector<std::string>& outputs) = 0;
+        virtual std::unique_ptr<NNModel<NodeData>> extract(const std::vector<std::string>& inputs, const std::vector<std::string>& outputs) const = 0;
         virtual ~NNModelSubgraphExtractor() = default;
-    protected:
-        SubgraphExtractor m_sgex;
 };
 
-class OnnxSubgraphExtractor: public NNModelSubgraphExtractor {
+// Shareable across threads: extract() only reads the model, and the
+// traversal state lives in a per-thread workspace, so concurrent calls
+// neither lock nor interfere.
+class OnnxSubgraphExtractor: public NNModelSubgraphExtractor<onnx::NodeProto> {
     public:
-        OnnxSubgraphExtractor(std::shared_ptr<OnnxModel> model): NNModelSubgraphExtractor(model), m_model(model){}
-        std::unique_ptr<NNModel> extract(const std::vector<std::string>& inputs, const std::vector<std::string>& outputs) override;
+        OnnxSubgraphExtractor(std::shared_ptr<const OnnxModel> model): m_model(std::move(model)) {}
+        std::unique_ptr<NNModel<onnx::NodeProto>> extract(const std::vector<std::string>& inputs, const std::vector<std::string>& outputs) const override;
+        std::vector<SeseRegion> regions() const { return m_model->regions().regions(); }
+        // The region's nodes plus the side inputs feeding them.
+        std::unique_ptr<NNModel<onnx::NodeProto>> extractRegion(const SeseRegion& region) const;
+        // The innermost single-entry/single-exit block around the named node.
+        std::unique_ptr<NNModel<onnx::NodeProto>> extractRegion(const std::string& node_name) const;
     private:
-        std::shared_ptr<OnnxModel> m_model;
+        // Sized for one adapter and reused across calls; members is empty
+        // between calls, so each one only clears the entries it set.
+        struct Workspace {
+            BasicGraphTraversal<OnnxGraphAdapter> outward;
+            BasicGraphTraversal<OnnxGraphAdapter> inward;
+            BoundarySweep boundary;
+            std::vector<NodeId> nodes;
+            NodeSet members;
+            uint64_t generation;
+            Workspace(const OnnxGraphAdapter& graph):
+                    outward(graph), inward(graph), members(graph.size()), generation(graph.generation()) {}
+            void bind(const OnnxGraphAdapter& graph) {
+                outward.bind(graph);
+                inward.bind(graph);
+                members.reset(graph.size());
+                generation = graph.generation();
+            }
+        };
+        Workspace& workspace() const;
+        std::unique_ptr<NNModel<onnx::NodeProto>> makeSubmodel(const std::vector<NodeId>& nodes, const NodeSet& members) const;
+        std::shared_ptr<const OnnxModel> m_model;
 };
-        
+
 #endif
@@ -5,273 +5,1188 @@
 #include <set>
 #include <fstream>
 #include <queue>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <atomic>
 
 #include "graph.h"
+#include "parallel.h"
 
-size_t Node::m_default_name_idx = 0;
+namespace {
 
-Node::Node(const std::any& data, const std::string& name): m_data(data), m_name(name) {}
+// Frontier nodes per thread below which a level is expanded inline.
+constexpr size_t kLevelGrain = 4096;
 
-Node::Node(const std::any& data): Node(data, "node" + std::to_string(Node::m_default_name_idx++)){}
+// Top-down frontier nodes and bottom-up bitmap words handed to one thread.
+constexpr size_t kBfsGrain = 1024;
+constexpr size_t kBfsWordGrain = 64;
 
-std::string Node::name() const { 
-    return m_name;
+// Switch to bottom-up once the frontier's edges exceed 1/alpha of the edges
+// left to explore, and back once the frontier shrinks below 1/beta of the
+// nodes (Beamer et al.).
+constexpr size_t kBfsAlpha = 14;
+constexpr size_t kBfsBeta = 24;
+
+template <typename Visit>
+void forEachNeighbor(const CompactGraphTopology& graph, NodeId id, Direction direction, Visit&& visit) {
+    if (direction != Direction::out) {
+        for (NodeId next: graph.inbound(id)) {
+            visit(next);
+        }
+    }
+    if (direction != Direction::in) {
+        for (NodeId next: graph.outbound(id)) {
+            visit(next);
+        }
+    }
+}
+
+// forEachNeighbor that stops at the first neighbor matching the predicate
+template <typename Predicate>
+bool anyNeighbor(const CompactGraphTopology& graph, NodeId id, Direction direction, Predicate&& predicate) {
+    if (direction != Direction::out) {
+        for (NodeId next: graph.inbound(id)) {
+            if (predicate(next)) {
+                return true;
+            }
+        }
+    }
+    if (direction != Direction::in) {
+        for (NodeId next: graph.outbound(id)) {
+            if (predicate(next)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Buffers one thread's newly reached nodes and appends them to the shared
+// next frontier in batches, so threads rarely contend on its size.
+class FrontierWriter {
+    static constexpr size_t kBatch = 256;
+    NodeId* m_out;
+    std::atomic<size_t>& m_size;
+    NodeId m_batch[kBatch];
+    size_t m_count = 0;
+    public:
+        FrontierWriter(NodeId* out, std::atomic<size_t>& size): m_out(out), m_size(size) {}
+        void push(NodeId id) {
+            m_batch[m_count++] = id;
+            if (m_count == kBatch) {
+                flush();
+            }
+        }
+        void flush() {
+            size_t at = m_size.fetch_add(m_count, std::memory_order_relaxed);
+            std::copy(m_batch, m_batch + m_count, m_out + at);
+            m_count = 0;
+        }
+};
+
+size_t degree(const CompactGraphTopology& graph, NodeId id, Direction direction) {
+    return (direction != Direction::out ? graph.inbound(id).size() : 0) + (direction != Direction::in ? graph.outbound(id).size() : 0);
+}
+
+Direction reverse(Direction direction) {
+    return direction == Direction::out ? Direction::in : direction == Direction::in ? Direction::out : Direction::bi;
+}
+
+// Level-synchronous Kahn: all nodes of a level are expanded concurrently and
+// whichever thread drops a successor's in-degree to zero releases it into the
+// next level. A level that was split across threads is sorted by id so the
+// result does not depend on thread timing.
+template <typename InDegree, typename ForEachOut>
+TopologicalLevels levelSort(size_t num_nodes, InDegree&& in_degree, ForEachOut&& for_each_out, unsigned num_threads) {
+    TopologicalLevels result;
+    result.level.assign(num_nodes, TopologicalLevels::kNoLevel);
+    result.order.reserve(num_nodes);
+    result.offsets.push_back(0);
+    std::vector<std::atomic<uint32_t>> remaining(num_nodes);
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        uint32_t degree = in_degree(id);
+        remaining[id].store(degree, std::memory_order_relaxed);
+        if (degree == 0) {
+            result.level[id] = 0;
+            result.order.push_back(id);
+        }
+    }
+    std::vector<std::vector<NodeId>> released(resolveThreads(num_threads));
+    for (uint32_t level = 0; result.order.size() > result.offsets.back(); ++level) {
+        size_t begin = result.offsets.back();
+        size_t end = result.order.size();
+        result.offsets.push_back(end);
+        unsigned num_blocks = parallelFor(end - begin, num_threads, kLevelGrain, [&](size_t first, size_t last, unsigned block) {
+            std::vector<NodeId>& next = released[block];
+            next.clear();
+            for (size_t i = begin + first; i < begin + last; ++i) {
+                for_each_out(result.order[i], [&](NodeId next_id) {
+                    if (remaining[next_id].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        result.level[next_id] = level + 1;
+                        next.push_back(next_id);
+                    }
+                });
+            }
+        });
+        size_t next_begin = result.order.size();
+        for (unsigned block = 0; block < num_blocks; ++block) {
+            result.order.insert(result.order.end(), released[block].begin(), released[block].end());
+        }
+        // release order depends on the blocks and their timing
+        std::sort(result.order.begin() + next_begin, result.order.end());
+    }
+    return result;
+}
+
+}
+
+std::atomic<size_t> NodeBase::m_default_name_idx{0};
+
+// tag 0 marks a node no graph has claimed yet
+std::atomic<uint64_t> NodeIdMap::m_next_tag{1};
+
+std::string NodeBase::defaultName() {
+    return "node" + std::to_string(NodeBase::m_default_name_idx.fetch_add(1, std::memory_order_relaxed));
+}
+
+NodeBase::NodeBase(const std::string& name): m_owned_name(name) {
+    m_name = m_owned_name;
 }
 
-const std::any& Node::data() const { 
-    return m_data;
+NodeBase::NodeBase(std::string_view interned_name, Interned): m_name(interned_name) {}
+
+// Copies always own their name: the original's interner may not outlive them.
+NodeBase::NodeBase(const NodeBase& other): m_owned_name(other.m_name) {
+    m_name = m_owned_name;
 }
 
-DirectedGraph::DirectedGraph(): DirectedGraph(std::string{"G"}) {}
+NodeBase::NodeBase(NodeBase&& other) {
+    bool owned = other.m_name.data() == other.m_owned_name.data();
+    m_owned_name = owned ? std::move(other.m_owned_name) : std::string(other.m_name);
+    m_name = m_owned_name;
+}
 
-DirectedGraph::DirectedGraph(const std::string& name): m_name(name) {}
+std::string_view NodeBase::name() const { 
+    return m_name;
+}
+
+void NameIndex::rehash(size_t num_slots) {
+    std::vector<Slot> slots(num_slots, Slot{kEmpty, 0});
+    size_t mask = num_slots - 1;
+    // the slot only depends on the stored hash bits, so no name is read again
+    for (const Slot& slot: m_slots) {
+        if (slot.id != kEmpty) {
+            size_t pos = slot.hash & mask;
+            while (slots[pos].id != kEmpty) {
+                pos = (pos + 1) & mask;
+            }
+            slots[pos] = slot;
+        }
+    }
+    m_slots = std::move(slots);
+}
 
-DirectedGraph::DirectedGraph(const std::string& name,
-        const std::vector<PtrNode>& nodes): m_name(name) {
-    for(PtrNode node: nodes) {
-        addNode(node);
+void NameIndex::reserve(size_t num_names) {
+    size_t num_slots = 16;
+    while (num_slots * 3 < num_names * 4) {
+        num_slots *= 2;
+    }
+    if (num_slots > m_slots.size()) {
+        rehash(num_slots);
     }
 }
 
-bool DirectedGraph::hasNode(PtrNode node) const {
-    return m_adj.find(node) != m_adj.end();
+void NameIndex::insert(NodeId id, const std::vector<NodeBase*>& nodes) {
+    reserve(m_size + 1);
+    std::string_view name = nodes[id]->name();
+    uint32_t name_hash = hash(name);
+    size_t mask = m_slots.size() - 1;
+    size_t pos = name_hash & mask;
+    for (; m_slots[pos].id != kEmpty; pos = (pos + 1) & mask) {
+        if (m_slots[pos].hash == name_hash && nodes[m_slots[pos].id]->name() == name) {
+            return;
+        }
+    }
+    m_slots[pos] = {id, name_hash};
+    m_size++;
 }
 
-std::optional<PtrNode> DirectedGraph::nodeByName(const std::string& name) const {
-    for (const auto& [node, adj]: m_adj ) {
-        if (node->name() == name) {
-            return {node};
+std::optional<NodeId> NameIndex::find(std::string_view name, const std::vector<NodeBase*>& nodes) const {
+    if (m_slots.empty()) {
+        return {};
+    }
+    uint32_t name_hash = hash(name);
+    size_t mask = m_slots.size() - 1;
+    for (size_t pos = name_hash & mask; m_slots[pos].id != kEmpty; pos = (pos + 1) & mask) {
+        if (m_slots[pos].hash == name_hash && nodes[m_slots[pos].id]->name() == name) {
+            return {m_slots[pos].id};
         }
     }
     return {};
 }
 
+std::optional<NodeId> GraphTopology::idByName(std::string_view name) const {
+    return m_name_index.find(name, m_nodes);
+}
 
-bool DirectedGraph::addNode(PtrNode node) {
-    if (m_adj.find(node) != m_adj.end()) {
-        return false;
+std::vector<NodeId> GraphTopology::idsByName(const std::vector<std::string>& names) const {
+    std::vector<NodeId> ids;
+    ids.reserve(names.size());
+    std::string missing;
+    for (const auto& name: names) {
+        auto id = idByName(name);
+        if (!id.has_value()) {
+            missing += missing.empty() ? name : ", " + name;
+            continue;
+        }
+        ids.push_back(id.value());
     }
-    m_adj[node] = {{"inbound", {}}, {"outbound", {}}};
-    return true;
+    if (!missing.empty()) {
+        throw std::runtime_error("Couldn't find nodes with names: " + missing);
+    }
+    return ids;
+}
+
+NodeId GraphTopology::insertNode(NodeBase* node) {
+    if (m_nodes.size() >= std::numeric_limits<NodeId>::max()) {
+        throw std::runtime_error("DirectedGraph node limit reached");
+    }
+    NodeId id = m_nodes.size();
+    m_ids.insert(node, id);
+    m_nodes.push_back(node);
+    m_adj.emplace_back();
+    m_name_index.insert(id, m_nodes); // first node wins on duplicate names
+    if (m_order) {
+        // a node without edges can go anywhere, so it goes last
+        m_order->position.push_back(m_order->order.size());
+        m_order->order.push_back(id);
+        m_order->visited.push_back(0);
+    }
+    m_version++;
+    return id;
+}
+
+uint32_t GraphTopology::labelId(const std::string& label) {
+    if (label.empty()) {
+        return 0;
+    }
+    auto [iter, inserted] = m_label_ids.try_emplace(label, m_labels.size());
+    if (inserted) {
+        m_labels.push_back(label);
+    }
+    return iter->second;
+}
+
+void GraphTopology::reserve(size_t num_nodes) {
+    m_nodes.reserve(num_nodes);
+    m_name_index.reserve(num_nodes);
+    m_adj.reserve(num_nodes);
 }
 
-bool DirectedGraph::addEdge(PtrNode from, PtrNode to, const std::string& label) {
-    const auto& out_nodes = m_adj[from]["outbound"];
-    auto to_iter = std::find_if(out_nodes.cbegin(), out_nodes.cend(), [=](const auto& p) { return p.first == to; });
-    if (to_iter != out_nodes.end()) {
+uint32_t GraphTopology::findNeighbor(NodeId owner, NodeId neighbor, bool outbound) const {
+    const NeighborList& list = outbound ? m_adj[owner].outbound : m_adj[owner].inbound;
+    if (list.size() > kIndexedDegree) {
+        const auto& index = (outbound ? m_out_index : m_in_index).at(owner);
+        auto iter = index.find(neighbor);
+        return iter == index.end() ? list.size() : iter->second;
+    }
+    auto iter = std::find_if(list.begin(), list.end(), [=](const Neighbor& n) { return n.node == neighbor; });
+    return iter - list.begin();
+}
+
+void GraphTopology::appendNeighbor(NodeId owner, Neighbor neighbor, bool outbound) {
+    NeighborList& list = outbound ? m_adj[owner].outbound : m_adj[owner].inbound;
+    list.push_back(neighbor);
+    if (list.size() <= kIndexedDegree) {
+        return;
+    }
+    auto& indices = outbound ? m_out_index : m_in_index;
+    auto [iter, created] = indices.try_emplace(owner);
+    if (created) {
+        for (uint32_t pos = 0; pos < list.size(); ++pos) {
+            iter->second.emplace(list[pos].node, pos);
+        }
+    }
+    else {
+        iter->second.emplace(neighbor.node, list.size() - 1);
+    }
+}
+
+void GraphTopology::eraseNeighbor(NodeId owner, uint32_t pos, bool outbound) {
+    // swap with the last entry so removal is O(1); neighbor order is not kept
+    NeighborList& list = outbound ? m_adj[owner].outbound : m_adj[owner].inbound;
+    auto& indices = outbound ? m_out_index : m_in_index;
+    auto iter = indices.find(owner);
+    if (iter != indices.end()) {
+        iter->second.erase(list[pos].node);
+        if (pos != list.size() - 1) {
+            iter->second[list.back().node] = pos;
+        }
+    }
+    list[pos] = list.back();
+    list.pop_back();
+    if (iter != indices.end() && list.size() <= kIndexedDegree) {
+        indices.erase(iter);
+    }
+}
+
+bool GraphTopology::addEdge(NodeId from_id, NodeId to_id) {
+    return addEdge(from_id, to_id, std::string{});
+}
+
+bool GraphTopology::addEdge(NodeId from_id, NodeId to_id, const std::string& label) {
+    if (from_id >= m_nodes.size() || to_id >= m_nodes.size()) {
+        throw std::out_of_range("DirectedGraph edge endpoint out of range");
+    }
+    if (findNeighbor(from_id, to_id, true) != m_adj[from_id].outbound.size()) {
         return false; // no multi-edges allowed
     }
-    m_adj[from]["outbound"].push_back({to, label});
-    m_adj[to]["inbound"].push_back({from, label});
-    m_adj[from]["inbound"]; // create missing keys
-    m_adj[to]["outbound"];
+    if (m_order) {
+        reorder(from_id, to_id);
+    }
+    uint32_t label_id = labelId(label);
+    appendNeighbor(from_id, {to_id, label_id}, true);
+    appendNeighbor(to_id, {from_id, label_id}, false);
+    m_version++;
+    return true;
+}
+
+bool GraphTopology::removeEdge(NodeId from_id, NodeId to_id) {
+    if (from_id >= m_nodes.size() || to_id >= m_nodes.size()) {
+        return false;
+    }
+    uint32_t out_pos = findNeighbor(from_id, to_id, true);
+    if (out_pos == m_adj[from_id].outbound.size()) {
+        return false; // no edge present
+    }
+    eraseNeighbor(from_id, out_pos, true);
+    eraseNeighbor(to_id, findNeighbor(to_id, from_id, false), false);
+    m_version++;
     return true;
 }
 
-bool DirectedGraph::addEdge(PtrNode from, PtrNode to) {
-    return addEdge(from, to, std::string{});
+std::vector<NodeId> GraphTopology::sortedIds() const {
+    if (m_order) {
+        return m_order->order;
+    }
+    TopologicalLevels sorted = levels();
+    if (!sorted.complete()) {
+        throw cycleError(findCycle(), [this](NodeId id) { return m_nodes[id]->name(); });
+    }
+    return std::move(sorted.order);
 }
 
-bool DirectedGraph::removeEdge(PtrNode from, PtrNode to) {
-    auto& out_nodes = m_adj[from]["outbound"];
-    auto to_iter = std::find_if(out_nodes.begin(), out_nodes.end(), [=](const auto& p) { return p.first == to; });
-    if (to_iter == out_nodes.end()) {
-        return false; // no edge present
+TopologicalLevels GraphTopology::levels(unsigned num_threads) const {
+    return levelSort(m_nodes.size(),
+            [this](NodeId id) { return m_adj[id].inbound.size(); },
+            [this](NodeId id, auto&& release) {
+                for (const Neighbor& next: m_adj[id].outbound) {
+                    release(next.node);
+                }
+            },
+            num_threads);
+}
+
+void GraphTopology::enableTopologicalOrder() {
+    if (m_order) {
+        return;
+    }
+    TopologicalLevels sorted = levels();
+    if (!sorted.complete()) {
+        throw cycleError(findCycle(), [this](NodeId id) { return m_nodes[id]->name(); });
+    }
+    auto order = std::make_unique<DynamicOrder>();
+    order->order = std::move(sorted.order);
+    order->position.resize(m_nodes.size());
+    for (uint32_t pos = 0; pos < order->order.size(); ++pos) {
+        order->position[order->order[pos]] = pos;
     }
-    out_nodes.erase(to_iter);
+    order->visited.assign(m_nodes.size(), 0);
+    m_order = std::move(order);
+}
 
-    auto& in_nodes = m_adj[to]["inbound"];
-    auto from_iter = std::find_if(in_nodes.begin(), in_nodes.end(), [=](const auto& p) { return p.first == from; });
-    in_nodes.erase(from_iter);
-    
-    return true;
+const std::vector<NodeId>& GraphTopology::topologicalOrder() const {
+    if (!m_order) {
+        throw std::runtime_error("DirectedGraph topological order is not enabled");
+    }
+    return m_order->order;
 }
 
-std::vector<PtrNode> DirectedGraph::nodes() const {
-    std::vector<PtrNode> nodes;
-    for (const auto& [node, adj]: m_adj) {
-        nodes.push_back(node);
+uint32_t GraphTopology::topologicalIndex(NodeId id) const {
+    if (!m_order) {
+        throw std::runtime_error("DirectedGraph topological order is not enabled");
     }
-    return nodes;
+    return m_order->position.at(id);
 }
 
-std::vector<PtrNode> DirectedGraph::nodes_sorted() const {
-    std::unordered_map<PtrNode, int> in_degree;
-    std::queue<PtrNode> frontier;
-    for (const auto& [node, adj]: m_adj) {
-        in_degree[node] = adj.at("inbound").size();
-        if (in_degree[node] == 0) {
-            frontier.push(node);
+void GraphTopology::reorder(NodeId from_id, NodeId to_id) {
+    // Pearce-Kelly: only nodes positioned between to and from can be out of
+    // order after adding from -> to. Collect those reachable from `to` and
+    // those reaching `from`, then swap the two groups within their slots.
+    DynamicOrder& d = *m_order;
+    uint32_t lower = d.position[to_id];
+    uint32_t upper = d.position[from_id];
+    if (lower > upper) {
+        return;
+    }
+    if (lower == upper) {
+        throw std::runtime_error("DirectedGraph edge would create a cycle");
+    }
+    if (++d.epoch == 0) {
+        std::fill(d.visited.begin(), d.visited.end(), 0);
+        d.epoch = 1;
+    }
+    d.forward.clear();
+    d.stack.assign(1, to_id);
+    d.visited[to_id] = d.epoch;
+    while (!d.stack.empty()) {
+        NodeId id = d.stack.back();
+        d.stack.pop_back();
+        d.forward.push_back(id);
+        for (const Neighbor& next: m_adj[id].outbound) {
+            if (next.node == from_id) {
+                throw std::runtime_error("DirectedGraph edge would create a cycle");
+            }
+            if (d.position[next.node] < upper && d.visited[next.node] != d.epoch) {
+                d.visited[next.node] = d.epoch;
+                d.stack.push_back(next.node);
+            }
         }
     }
-    std::vector<PtrNode> nodes;
-    while (!frontier.empty()) {
-        auto node = frontier.front();
-        nodes.push_back(node);
-        frontier.pop();
-        for (const auto& next_node: outbound(node)) {
-            in_degree[next_node]--;
-            if (in_degree[next_node] == 0) {
-                frontier.push(next_node);
+    // no cycle, so the backward set cannot meet the forward one
+    d.backward.clear();
+    d.stack.assign(1, from_id);
+    d.visited[from_id] = d.epoch;
+    while (!d.stack.empty()) {
+        NodeId id = d.stack.back();
+        d.stack.pop_back();
+        d.backward.push_back(id);
+        for (const Neighbor& prev: m_adj[id].inbound) {
+            if (d.position[prev.node] > lower && d.visited[prev.node] != d.epoch) {
+                d.visited[prev.node] = d.epoch;
+                d.stack.push_back(prev.node);
             }
         }
     }
-    if (nodes.size() < m_adj.size()) {
-        throw std::runtime_error("DirectedGraph contains a cycle");
+    auto by_position = [&d](NodeId a, NodeId b) { return d.position[a] < d.position[b]; };
+    std::sort(d.forward.begin(), d.forward.end(), by_position);
+    std::sort(d.backward.begin(), d.backward.end(), by_position);
+    d.slots.clear();
+    for (NodeId id: d.backward) {
+        d.slots.push_back(d.position[id]);
+    }
+    for (NodeId id: d.forward) {
+        d.slots.push_back(d.position[id]);
+    }
+    std::sort(d.slots.begin(), d.slots.end());
+    size_t slot = 0;
+    for (const auto* group: {&d.backward, &d.forward}) {
+        for (NodeId id: *group) {
+            d.position[id] = d.slots[slot];
+            d.order[d.slots[slot]] = id;
+            slot++;
+        }
     }
-    return nodes;
 }
 
-std::vector<PtrNode> DirectedGraph::top() const {
-    std::vector<PtrNode> nodes;
-    for (const auto& [node, adj]: m_adj) {
-        if (adj.at("inbound").empty()) {
-            nodes.push_back(node);
-        }
+StronglyConnectedComponents GraphTopology::components() const {
+    return stronglyConnectedComponents(*this);
+}
+
+std::vector<NodeId> GraphTopology::findCycle() const {
+    return ::findCycle(*this, components());
+}
+
+std::vector<NodeId> GraphTopology::topIds() const {
+    return ::topIds(*this);
+}
+
+std::vector<NodeId> GraphTopology::bottomIds() const {
+    return ::bottomIds(*this);
+}
+
+GraphBuilderBase::GraphBuilderBase(size_t num_nodes, const std::string& name): EdgeBuffer(num_nodes), m_name(name) {
+    if (num_nodes >= std::numeric_limits<NodeId>::max()) {
+        throw std::runtime_error("GraphBuilder node limit exceeded");
     }
-    return nodes;
 }
 
-std::vector<PtrNode> DirectedGraph::bottom() const {
-    std::vector<PtrNode> nodes;
-    for (const auto& [node, adj]: m_adj) {
-        if (adj.at("outbound").empty()) {
-            nodes.push_back(node);
+uint32_t EdgeBuffer::labelId(const std::string& label) {
+    if (label.empty()) {
+        return 0;
+    }
+    auto [iter, inserted] = m_label_ids.try_emplace(label, m_labels.size());
+    if (inserted) {
+        m_labels.push_back(label);
+    }
+    return iter->second;
+}
+
+void EdgeBuffer::append(EdgeBuffer&& other) {
+    std::vector<uint32_t> label_map(other.m_labels.size());
+    for (uint32_t label = 0; label < other.m_labels.size(); ++label) {
+        label_map[label] = labelId(other.m_labels[label]);
+    }
+    m_edges.reserve(m_edges.size() + other.m_edges.size());
+    for (const auto& e: other.m_edges) {
+        m_edges.push_back({e.from, e.to, label_map[e.label]});
+    }
+    other.m_edges.clear();
+    other.m_edges.shrink_to_fit();
+}
+
+void EdgeBuffer::addEdge(NodeId from, NodeId to) {
+    if (from >= m_num_nodes || to >= m_num_nodes) {
+        throw std::out_of_range("GraphBuilder edge endpoint out of range");
+    }
+    m_edges.push_back({from, to, 0});
+}
+
+void EdgeBuffer::addEdge(NodeId from, NodeId to, const std::string& label) {
+    if (from >= m_num_nodes || to >= m_num_nodes) {
+        throw std::out_of_range("GraphBuilder edge endpoint out of range");
+    }
+    m_edges.push_back({from, to, labelId(label)});
+}
+
+void EdgeBuffer::addEdges(const std::vector<BuilderEdge>& edges) {
+    m_edges.reserve(m_edges.size() + edges.size());
+    for (const auto& e: edges) {
+        addEdge(e.from, e.to, e.label);
+    }
+}
+
+void GraphBuilderBase::fill(GraphTopology& graph, const std::vector<NodeBase*>& nodes) {
+    if (m_built) {
+        throw std::runtime_error("GraphBuilder has already built its graph");
+    }
+    graph.reserve(nodes.size());
+    for (NodeId id = 0; id < nodes.size(); ++id) {
+        if (nodes[id] == nullptr) {
+            throw std::runtime_error("GraphBuilder node " + std::to_string(id) + " was never set");
+        }
+        if (graph.m_ids.find(nodes[id], graph.size()).has_value()) {
+            throw std::runtime_error("GraphBuilder node " + std::string(nodes[id]->name()) + " was set more than once");
         }
+        graph.insertNode(nodes[id]);
+    }
+    m_built = true;
+    graph.m_labels = std::move(m_labels);
+    graph.m_label_ids = std::move(m_label_ids);
+
+    // counting sort by source, then sort each (usually tiny) bucket by target
+    std::vector<uint32_t> offsets(nodes.size() + 1, 0);
+    for (const auto& e: m_edges) {
+        offsets[e.from + 1]++;
+    }
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+    std::vector<PendingEdge> sorted(m_edges.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (const auto& e: m_edges) {
+        sorted[fill[e.from]++] = e;
     }
-    return nodes;
+    m_edges.clear();
+    m_edges.shrink_to_fit();
+
+    for (NodeId from = 0; from < nodes.size(); ++from) {
+        auto begin = sorted.begin() + offsets[from];
+        auto end = sorted.begin() + offsets[from + 1];
+        std::stable_sort(begin, end, [](const PendingEdge& a, const PendingEdge& b) { return a.to < b.to; });
+        for (auto iter = begin; iter != end; ++iter) {
+            if (iter != begin && iter->to == (iter - 1)->to) {
+                continue; // no multi-edges allowed, first label wins
+            }
+            graph.appendNeighbor(from, {iter->to, iter->label}, true);
+            graph.appendNeighbor(iter->to, {from, iter->label}, false);
+        }
+    }
+    graph.m_version++;
 }
 
-std::vector<DirectedEdge> DirectedGraph::edges() const {
-    std::vector<DirectedEdge> edges;
-    for (const auto& [node, adj]: m_adj) {
-        for (const auto& p: adj.at("outbound")) {
-            edges.push_back({node, p.first});
+CompactGraphTopology::CompactGraphTopology(const GraphTopology& graph):
+        m_name(graph.m_name), m_nodes(graph.m_nodes), m_ids(graph.m_ids), m_labels(graph.m_labels) {
+    m_out_offsets.assign(m_nodes.size() + 1, 0);
+    m_in_offsets.assign(m_nodes.size() + 1, 0);
+    for (NodeId id = 0; id < m_nodes.size(); ++id) {
+        m_out_offsets[id + 1] = m_out_offsets[id] + graph.m_adj[id].outbound.size();
+        m_in_offsets[id + 1] = m_in_offsets[id] + graph.m_adj[id].inbound.size();
+    }
+    if (m_out_offsets.back() >= std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("DirectedGraph has too many edges to freeze");
+    }
+    m_out_targets.resize(m_out_offsets.back());
+    m_out_labels.resize(m_out_offsets.back());
+    m_in_targets.resize(m_in_offsets.back());
+    for (NodeId id = 0; id < m_nodes.size(); ++id) {
+        uint32_t out = m_out_offsets[id];
+        for (const Neighbor& n: graph.m_adj[id].outbound) {
+            m_out_targets[out] = n.node;
+            m_out_labels[out++] = n.label;
+        }
+        NodeId* in = m_in_targets.data() + m_in_offsets[id];
+        for (const Neighbor& n: graph.m_adj[id].inbound) {
+            *in++ = n.node;
         }
     }
-    return edges;
 }
 
-std::vector<PtrNode> DirectedGraph::inbound(PtrNode node) const {
-    std::vector<PtrNode> nodes;
-    for (const auto& p: m_adj.at(node).at("inbound")) {
-        nodes.push_back(p.first);
+std::optional<NodeId> CompactGraphTopology::id(const NodeBase* node) const {
+    return m_ids.find(node, size());
+}
+
+std::vector<NodeId> CompactGraphTopology::nodes_sorted() const {
+    TopologicalLevels sorted = levels();
+    if (!sorted.complete()) {
+        throw cycleError(findCycle(), [this](NodeId id) { return m_nodes[id]->name(); });
     }
-    return nodes;
+    return std::move(sorted.order);
+}
+
+TopologicalLevels CompactGraphTopology::levels(unsigned num_threads) const {
+    return levelSort(size(),
+            [this](NodeId id) { return m_in_offsets[id + 1] - m_in_offsets[id]; },
+            [this](NodeId id, auto&& release) {
+                for (NodeId next_id: outbound(id)) {
+                    release(next_id);
+                }
+            },
+            num_threads);
+}
+
+StronglyConnectedComponents CompactGraphTopology::components() const {
+    return stronglyConnectedComponents(*this);
+}
+
+std::vector<NodeId> CompactGraphTopology::findCycle() const {
+    return ::findCycle(*this, components());
+}
+
+std::vector<NodeId> CompactGraphTopology::top() const {
+    return topIds(*this);
+}
+
+std::vector<NodeId> CompactGraphTopology::bottom() const {
+    return bottomIds(*this);
 }
 
-std::vector<PtrNode> DirectedGraph::outbound(PtrNode node) const {
-    std::vector<PtrNode> nodes;
-    for (const auto& p: m_adj.at(node).at("outbound")) {
-        nodes.push_back(p.first);
+ParallelBfs::ParallelBfs(const CompactGraphTopology& graph, unsigned num_threads):
+        ParallelBfs(graph, std::make_shared<WorkerPool>(num_threads)) {}
+
+ParallelBfs::ParallelBfs(const CompactGraphTopology& graph, std::shared_ptr<WorkerPool> pool):
+        m_graph(&graph), m_pool(std::move(pool)), m_visited((graph.size() + 63) / 64),
+        m_frontier_bits((graph.size() + 63) / 64, 0), m_frontier(graph.size()), m_next(graph.size()) {
+    reset();
+}
+
+void ParallelBfs::reset() {
+    for (auto& word: m_visited) {
+        word.store(0, std::memory_order_relaxed);
     }
-    return nodes;
 }
 
-std::ostream& operator<<(std::ostream& os, const Node& node) {
-    os << node.name();
-    return os;
+void ParallelBfs::run(const std::vector<NodeId>& sources, Direction direction) {
+    const CompactGraphTopology& graph = *m_graph;
+    size_t total_edges = direction == Direction::bi ? 2 * graph.numEdges() : graph.numEdges();
+    size_t frontier_edges = 0;
+    size_t explored_edges = 0;
+    m_frontier_size = 0;
+    for (NodeId id: sources) {
+        if (markVisited(id)) {
+            m_frontier[m_frontier_size++] = id;
+            frontier_edges += degree(graph, id, direction);
+        }
+    }
+    bool bottom_up = false;
+    while (m_frontier_size != 0) {
+        explored_edges += frontier_edges;
+        size_t unexplored_edges = total_edges > explored_edges ? total_edges - explored_edges : 0;
+        if (!bottom_up && frontier_edges > unexplored_edges / kBfsAlpha) {
+            bottom_up = true;
+        }
+        else if (bottom_up && m_frontier_size < graph.size() / kBfsBeta) {
+            bottom_up = false;
+        }
+        frontier_edges = bottom_up ? bottomUp(direction) : topDown(direction);
+    }
 }
 
-std::ostream& operator<<(std::ostream& os, const DirectedEdge& edge) {
-    os << edge.from->name() << "->" << edge.to->name();
-    return os;
+size_t ParallelBfs::topDown(Direction direction) {
+    const CompactGraphTopology& graph = *m_graph;
+    std::atomic<size_t> next_size{0};
+    std::atomic<size_t> frontier_edges{0};
+    m_pool->run(m_frontier_size, kBfsGrain, [&](size_t begin, size_t end, unsigned) {
+        FrontierWriter next(m_next.data(), next_size);
+        size_t next_edges = 0;
+        for (size_t i = begin; i < end; ++i) {
+            forEachNeighbor(graph, m_frontier[i], direction, [&](NodeId id) {
+                // test before the atomic RMW so already visited nodes stay read-only
+                if (!visited(id) && markVisited(id)) {
+                    next.push(id);
+                    next_edges += degree(graph, id, direction);
+                }
+            });
+        }
+        next.flush();
+        frontier_edges.fetch_add(next_edges, std::memory_order_relaxed);
+    });
+    m_frontier.swap(m_next);
+    m_frontier_size = next_size.load(std::memory_order_relaxed);
+    return frontier_edges.load(std::memory_order_relaxed);
 }
 
-void printNodes(const std::vector<PtrNode>& nodes) {
-    for (PtrNode n: nodes) {
-        std::cout << *n << ' ';
+size_t ParallelBfs::bottomUp(Direction direction) {
+    const CompactGraphTopology& graph = *m_graph;
+    Direction parents = reverse(direction);
+    std::fill(m_frontier_bits.begin(), m_frontier_bits.end(), 0);
+    for (size_t i = 0; i < m_frontier_size; ++i) {
+        m_frontier_bits[m_frontier[i] / 64] |= uint64_t{1} << (m_frontier[i] % 64);
     }
-    std::cout << '\n';
+    auto in_frontier = [this](NodeId parent) { return (m_frontier_bits[parent / 64] >> (parent % 64)) & 1; };
+    std::atomic<size_t> next_size{0};
+    std::atomic<size_t> frontier_edges{0};
+    // each block owns whole words of the visited bitmap, so no two threads
+    // ever write the same word in this step
+    m_pool->run(m_visited.size(), kBfsWordGrain, [&](size_t begin, size_t end, unsigned) {
+        FrontierWriter next(m_next.data(), next_size);
+        size_t next_edges = 0;
+        for (size_t word = begin; word < end; ++word) {
+            uint64_t found = 0;
+            for (uint64_t unvisited = ~visitedWord(word); unvisited != 0; unvisited &= unvisited - 1) {
+                NodeId id = word * 64 + __builtin_ctzll(unvisited);
+                if (id >= graph.size()) {
+                    break;
+                }
+                if (anyNeighbor(graph, id, parents, in_frontier)) {
+                    found |= uint64_t{1} << (id % 64);
+                    next.push(id);
+                    next_edges += degree(graph, id, direction);
+                }
+            }
+            if (found != 0) {
+                m_visited[word].fetch_or(found, std::memory_order_relaxed);
+            }
+        }
+        next.flush();
+        frontier_edges.fetch_add(next_edges, std::memory_order_relaxed);
+    });
+    m_frontier.swap(m_next);
+    m_frontier_size = next_size.load(std::memory_order_relaxed);
+    return frontier_edges.load(std::memory_order_relaxed);
 }
 
-void printEdges(const DirectedGraph& g) {
-    for (const auto& e: g.edges()) {
-        std::cout << e << ' ';
+AncestryLabels::AncestryLabels(const CompactGraphTopology& graph):
+        m_graph(&graph), m_pre(graph.size(), 0), m_post(graph.size(), 0), m_low(graph.size(), 0), m_marks(graph.size(), 0) {
+    // m_marks doubles as DFS state here: 0 unvisited, 1 on the stack, 2 done
+    struct Frame {
+        NodeId node;
+        uint32_t next;
+    };
+    std::vector<Frame> pending;
+    uint32_t pre = 0;
+    uint32_t post = 0;
+    auto visit_from = [&](NodeId root) {
+        m_marks[root] = 1;
+        m_pre[root] = pre++;
+        pending.push_back({root, 0});
+        while (!pending.empty()) {
+            Frame& frame = pending.back();
+            NodeIdRange out = graph.outbound(frame.node);
+            if (frame.next < out.size()) {
+                NodeId next = out.begin()[frame.next++];
+                if (m_marks[next] == 0) {
+                    m_marks[next] = 1;
+                    m_pre[next] = pre++;
+                    pending.push_back({next, 0});
+                }
+                else if (m_marks[next] == 1) {
+                    m_acyclic = false;
+                }
+                continue;
+            }
+            NodeId id = frame.node;
+            pending.pop_back();
+            m_marks[id] = 2;
+            m_post[id] = post++;
+            m_low[id] = m_post[id];
+            for (NodeId next: out) {
+                m_low[id] = std::min(m_low[id], m_low[next]);
+            }
+        }
+    };
+    // sources first so the spanning forest covers as much as possible
+    for (NodeId id: graph.top()) {
+        visit_from(id);
+    }
+    for (NodeId id = 0; id < graph.size(); ++id) {
+        if (m_marks[id] == 0) {
+            visit_from(id);
+        }
+    }
+    std::fill(m_marks.begin(), m_marks.end(), 0);
+    if (m_acyclic) {
+        m_level = std::move(graph.levels().level);
     }
-    std::cout << '\n';
 }
 
-SubgraphExtractor::SubgraphExtractor(DirectedGraph* graph): m_graph(graph) {}
+size_t AncestryLabels::memoryBytes() const {
+    return (m_pre.capacity() + m_post.capacity() + m_low.capacity() + m_level.capacity() + m_marks.capacity()) * sizeof(uint32_t);
+}
 
-void SubgraphExtractor::dfs(PtrNode node, std::unordered_set<PtrNode>& visited, Direction dir) {
-    visited.insert(node);
-    std::vector<PtrNode> adj;
-    if (dir == Direction::in) {
-        adj = m_graph->inbound(node);
+bool AncestryLabels::isAncestor(NodeId ancestor, NodeId descendant) {
+    if (m_pre.at(ancestor) == m_pre.at(descendant)) {
+        return false;
     }
-    else if (dir == Direction::out) {
-        adj = m_graph->outbound(node);
+    if (treeAncestor(ancestor, descendant)) {
+        return true;
     }
-    else {
-        adj = m_graph->inbound(node);
-        for (PtrNode out_node: m_graph->outbound(node)) {
-            adj.push_back(out_node);
+    if (!mayReach(ancestor, descendant)) {
+        return false;
+    }
+    if (++m_epoch == 0) {
+        std::fill(m_marks.begin(), m_marks.end(), 0);
+        m_epoch = 1;
+    }
+    m_stack.assign(1, ancestor);
+    m_marks[ancestor] = m_epoch;
+    while (!m_stack.empty()) {
+        NodeId id = m_stack.back();
+        m_stack.pop_back();
+        for (NodeId next: m_graph->outbound(id)) {
+            if (next == descendant || treeAncestor(next, descendant)) {
+                return true;
+            }
+            if (m_marks[next] != m_epoch && mayReach(next, descendant)) {
+                m_marks[next] = m_epoch;
+                m_stack.push_back(next);
+            }
         }
     }
-    for (PtrNode adj_node: adj) {
-        if (visited.find(adj_node) == visited.end()) {
-            dfs(adj_node, visited, dir);
+    return false;
+}
+
+AncestryLabels::Bounds AncestryLabels::bounds(const std::vector<NodeId>& targets, Bounds from) const {
+    if (!m_acyclic) {
+        return from;
+    }
+    for (NodeId id: targets) {
+        from.max_level = std::max(from.max_level, m_level.at(id));
+        from.min_post = std::min(from.min_post, m_post[id]);
+        from.max_low = std::max(from.max_low, m_low[id]);
+    }
+    return from;
+}
+
+void DominatorTree::numberTree() {
+    const NodeId root = size();
+    // nodes no entry reaches take no part, so they hang off the root
+    for (NodeId id = 0; id < root; ++id) {
+        if (m_idom[id] == kRoot) {
+            m_idom[id] = root;
         }
     }
+    // pre/post numbers over the dominator tree for O(1) dominates()
+    std::vector<uint32_t> child_offsets(root + 2, 0);
+    for (NodeId id = 0; id < root; ++id) {
+        child_offsets[m_idom[id] + 1]++;
+    }
+    for (size_t i = 1; i < child_offsets.size(); ++i) {
+        child_offsets[i] += child_offsets[i - 1];
+    }
+    std::vector<NodeId> children(root);
+    std::vector<uint32_t> fill(child_offsets.begin(), child_offsets.end() - 1);
+    for (NodeId id = 0; id < root; ++id) {
+        children[fill[m_idom[id]]++] = id;
+    }
+    struct Frame {
+        NodeId node;
+        uint32_t next;
+    };
+    std::vector<Frame> frames;
+    uint32_t pre = 0;
+    uint32_t done = 0;
+    frames.push_back({root, child_offsets[root]});
+    m_pre[root] = pre++;
+    while (!frames.empty()) {
+        Frame& frame = frames.back();
+        if (frame.next < child_offsets[frame.node + 1]) {
+            NodeId child = children[frame.next++];
+            m_pre[child] = pre++;
+            frames.push_back({child, child_offsets[child]});
+            continue;
+        }
+        m_post[frame.node] = done++;
+        frames.pop_back();
+    }
+}
+
+std::optional<SeseRegion> RegionFinder::regionAt(NodeId entry) const {
+    // exits further up the post-dominator tree are reachable around entry too,
+    // so the immediate post-dominator is the only candidate
+    if (!m_forks.contains(entry)) {
+        return {};
+    }
+    NodeId exit = m_post_dominators.idom(entry);
+    if (exit == DominatorTree::kRoot || !m_dominators.dominates(entry, exit)) {
+        return {};
+    }
+    return SeseRegion{entry, exit};
 }
 
-void SubgraphExtractor::ensureNodesExist(const std::vector<PtrNode>& inputs, const std::vector<PtrNode>& outputs) {
-    std::vector<PtrNode> boundary_nodes(inputs.begin(), inputs.end());
-    boundary_nodes.insert(boundary_nodes.end(), outputs.begin(), outputs.end());
-    for (PtrNode node: boundary_nodes) {
-        if (!m_graph->hasNode(node)) {
-            throw std::runtime_error("Node: " + node->name() + " not present in graph");
+std::vector<SeseRegion> RegionFinder::regions() const {
+    std::vector<SeseRegion> regions;
+    for (NodeId id: m_forks) {
+        if (auto region = regionAt(id)) {
+            regions.push_back(region.value());
         }
     }
+    return regions;
 }
-                
-std::unique_ptr<DirectedGraph> SubgraphExtractor::extract(const std::vector<PtrNode>& inputs, const std::vector<PtrNode>& outputs) {
-    // TODO handle case of invalid inputs, outputs - outputs not reachable from inputs
-    // TODO handle inputs/outputs where one is ancestor/descendant of another
-    ensureNodesExist(inputs, outputs);
 
-    std::unordered_set<PtrNode> outward_subgraph_nodes(outputs.begin(), outputs.end());
-    for (PtrNode node: inputs) {
-        if (outward_subgraph_nodes.find(node) != outward_subgraph_nodes.end()) {
-            continue;
+std::optional<SeseRegion> RegionFinder::smallestRegion(NodeId id) const {
+    for (NodeId entry = id; entry != DominatorTree::kRoot; entry = m_dominators.idom(entry)) {
+        auto region = regionAt(entry);
+        if (region.has_value() && m_post_dominators.dominates(region->exit, id)) {
+            return region;
         }
-        dfs(node, outward_subgraph_nodes, Direction::out);
     }
+    return {};
+}
 
-    std::unordered_set<PtrNode> inward_subgraph_nodes(inputs.begin(), inputs.end());
-    for (PtrNode node: outputs) {
-        if (inward_subgraph_nodes.find(node) != inward_subgraph_nodes.end()) {
-            continue;
+ReachabilityIndex::ReachabilityIndex(const CompactGraphTopology& graph, size_t memory_budget):
+        m_graph(&graph), m_position(graph.size()), m_marks(graph.size(), 0) {
+    TopologicalLevels sorted = graph.levels();
+    if (!sorted.complete()) {
+        throw std::runtime_error("DirectedGraph contains a cycle");
+    }
+    size_t num_nodes = graph.size();
+    size_t exact_words = (num_nodes + 63) / 64;
+    m_words = std::max<size_t>(std::min(exact_words, memory_budget / std::max<size_t>(num_nodes * 8, 1)), 1);
+    m_bits.assign(num_nodes * m_words, 0);
+    for (uint32_t pos = 0; pos < num_nodes; ++pos) {
+        m_position[sorted.order[pos]] = pos;
+    }
+    // successors come later in the order, so walking it backwards finishes them first
+    for (size_t pos = num_nodes; pos-- > 0;) {
+        NodeId id = sorted.order[pos];
+        uint64_t* bits = &m_bits[id * m_words];
+        uint32_t own = slot(id);
+        bits[own / 64] |= uint64_t{1} << (own % 64);
+        for (NodeId next: graph.outbound(id)) {
+            const uint64_t* next_bits = &m_bits[next * m_words];
+            for (size_t word = 0; word < m_words; ++word) {
+                bits[word] |= next_bits[word];
+            }
         }
-        dfs(node, inward_subgraph_nodes, Direction::in);
     }
+    m_targets.assign(m_words, 0);
+}
 
-    inward_subgraph_nodes.merge(outward_subgraph_nodes);
-    std::unordered_set<PtrNode>& subgraph_nodes = inward_subgraph_nodes;
+size_t ReachabilityIndex::memoryBytes() const {
+    return m_bits.capacity() * sizeof(uint64_t) + (m_position.capacity() + m_marks.capacity()) * sizeof(uint32_t);
+}
 
-    return cloneGraph(subgraph_nodes);
+uint32_t ReachabilityIndex::nextEpoch() {
+    // two stamps per query: candidate and confirmed
+    m_epoch += 2;
+    if (m_epoch < 2) {
+        std::fill(m_marks.begin(), m_marks.end(), 0);
+        m_epoch = 2;
+    }
+    return m_epoch;
+}
+
+bool ReachabilityIndex::isAncestor(NodeId ancestor, NodeId descendant) {
+    if (m_position.at(ancestor) >= m_position.at(descendant)) {
+        return false;
+    }
+    uint32_t target = slot(descendant);
+    if (!hasSlot(ancestor, target)) {
+        return false;
+    }
+    if (exact()) {
+        return true;
+    }
+    uint32_t epoch = nextEpoch();
+    uint32_t limit = m_position[descendant];
+    m_stack.assign(1, ancestor);
+    m_marks[ancestor] = epoch;
+    while (!m_stack.empty()) {
+        NodeId id = m_stack.back();
+        m_stack.pop_back();
+        for (NodeId next: m_graph->outbound(id)) {
+            if (next == descendant) {
+                return true;
+            }
+            if (m_marks[next] != epoch && m_position[next] < limit && hasSlot(next, target)) {
+                m_marks[next] = epoch;
+                m_stack.push_back(next);
+            }
+        }
+    }
+    return false;
 }
 
-std::unique_ptr<DirectedGraph> SubgraphExtractor::cloneGraph(const std::unordered_set<PtrNode>& nodes) const {
-   auto graph_clone = std::make_unique<DirectedGraph>("subgraph");
-    std::unordered_map<PtrNode, PtrNode> clone_map;
-    for (PtrNode node: nodes) {
-        if (clone_map.find(node) == clone_map.end()) {
-            clone_map[node] = std::make_shared<Node>(node->data(), node->name());
+const std::vector<NodeId>& ReachabilityIndex::between(const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs) {
+    uint32_t candidate = nextEpoch();
+    uint32_t confirmed = candidate + 1;
+    m_between.clear();
+    std::fill(m_targets.begin(), m_targets.end(), 0);
+    m_target_words.clear();
+    uint32_t limit = 0;
+    for (NodeId id: outputs) {
+        uint32_t target = slot(id);
+        if (m_targets[target / 64] == 0) {
+            m_target_words.push_back(target / 64);
         }
-        PtrNode node_clone = clone_map[node];
-        graph_clone->addNode(node_clone);
-        for (PtrNode out_node: m_graph->outbound(node)) {
-            if (nodes.find(out_node) == nodes.end()) {
-                continue;
+        m_targets[target / 64] |= uint64_t{1} << (target % 64);
+        limit = std::max(limit, m_position.at(id));
+    }
+    auto may_reach_output = [this, limit](NodeId id) {
+        if (m_position[id] > limit) {
+            return false;
+        }
+        const uint64_t* bits = &m_bits[id * m_words];
+        return std::any_of(m_target_words.begin(), m_target_words.end(), [&](uint32_t word) {
+            return (bits[word] & m_targets[word]) != 0;
+        });
+    };
+    // forward from the inputs, skipping nodes whose bitset rules out every output
+    m_stack.clear();
+    for (NodeId id: inputs) {
+        if (m_marks.at(id) != candidate && may_reach_output(id)) {
+            m_marks[id] = candidate;
+            m_stack.push_back(id);
+        }
+    }
+    while (!m_stack.empty()) {
+        NodeId id = m_stack.back();
+        m_stack.pop_back();
+        m_between.push_back(id);
+        for (NodeId next: m_graph->outbound(id)) {
+            if (m_marks[next] != candidate && may_reach_output(next)) {
+                m_marks[next] = candidate;
+                m_stack.push_back(next);
             }
-            if (clone_map.find(out_node) == clone_map.end()) {
-                clone_map[out_node] = std::make_shared<Node>(out_node->data(), out_node->name());
+        }
+    }
+    if (!exact()) {
+        // folded bits admit false candidates; keep those that reach an output
+        m_between.clear();
+        for (NodeId id: outputs) {
+            if (m_marks[id] == candidate) {
+                m_marks[id] = confirmed;
+                m_stack.push_back(id);
+            }
+        }
+        while (!m_stack.empty()) {
+            NodeId id = m_stack.back();
+            m_stack.pop_back();
+            m_between.push_back(id);
+            for (NodeId prev: m_graph->inbound(id)) {
+                if (m_marks[prev] == candidate) {
+                    m_marks[prev] = confirmed;
+                    m_stack.push_back(prev);
+                }
             }
-            PtrNode out_node_clone = clone_map[out_node];
-            graph_clone->addEdge(node_clone, out_node_clone);
         }
     }
-    return graph_clone;
+    std::sort(m_between.begin(), m_between.end());
+    return m_between;
 }
+
+std::ostream& operator<<(std::ostream& os, const NodeBase& node) {
+    os << node.name();
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const DirectedEdge& edge) {
+    os << edge.from->name() << "->" << edge.to->name();
+    return os;
+}
+
+void printNodes(const std::vector<PtrNode>& nodes) {
+    for (PtrNode n: nodes) {
+        std::cout << *n << ' ';
+    }
+    std::cout << '\n';
+}
+
+void printEdges(const DirectedGraph& g) {
+    for (const auto& e: g.edgeRange()) {
+        std::cout << e.from << "->" << e.to << ' ';
+    }
+    std::cout << '\n';
+}
+
+const std::vector<NodeId>& SubgraphExtractorBase::collectNodes(const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs) {
+    if (m_outward->graph().size() >= m_parallel_threshold) {
+        return collectNodesParallel(inputs, outputs);
+    }
+    collectSubgraph(*m_outward, *m_inward, inputs, outputs, m_subgraph_nodes);
+    return m_subgraph_nodes;
+}
+
+const std::vector<NodeId>& SubgraphExtractorBase::collectNodesParallel(const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs) {
+    if (!m_parallel_outward) {
+        if (!m_pool) {
+            m_pool = std::make_shared<WorkerPool>(m_num_threads);
+        }
+        m_parallel_outward = std::make_unique<ParallelBfs>(m_outward->graph(), m_pool);
+        m_parallel_inward = std::make_unique<ParallelBfs>(m_outward->graph(), m_pool);
+    }
+    // same sweeps as the serial path: outputs stop the forward one, inputs
+    // the backward one, and the result is everything either of them marked
+    ParallelBfs& outward = *m_parallel_outward;
+    ParallelBfs& inward = *m_parallel_inward;
+    outward.reset();
+    inward.reset();
+    for (NodeId id: outputs) {
+        outward.markVisited(id);
+    }
+    outward.run(inputs, Direction::out);
+    for (NodeId id: inputs) {
+        inward.markVisited(id);
+    }
+    inward.run(outputs, Direction::in);
+    outward.copyVisited(m_outward_set);
+    inward.copyVisited(m_inward_set);
+    m_outward_set |= m_inward_set;
+    m_subgraph_nodes.clear();
+    m_outward_set.appendTo(m_subgraph_nodes);
+    return m_subgraph_nodes;
+}
+
+void SubgraphExtractorBase::checkBoundary(const std::vector<NodeId>& inputs, const std::vector<NodeId>& outputs) {
+    if (!m_ancestry) {
+        m_ancestry = std::make_unique<AncestryLabels>(m_outward->graph());
+    }
+    const AncestryLabels& labels = *m_ancestry;
+    const CompactGraphTopology& graph = labels.graph();
+    auto name = [&graph](NodeId id) { return std::string(graph.nodeName(id)); };
+    // one sweep per side, skipping whatever the labels rule out as leading
+    // to a boundary node the sweep still has to find
+    AncestryLabels::Bounds output_bounds = labels.bounds(outputs);
+    AncestryLabels::Bounds boundary_bounds = labels.bounds(inputs, output_bounds);
+    auto related_inputs = m_boundary.run(graph, inputs, [&](NodeId id) { return labels.mayReachAny(id, boundary_bounds); });
+    for (NodeId output: outputs) {
+        if (!m_boundary.reached(output)) {
+            throw std::runtime_error("Output: " + name(output) + " is not reachable from the inputs");
+        }
+    }
+    if (related_inputs) {
+        throw std::runtime_error("Input: " + name(related_inputs->first) + " is an ancestor of Input: " + name(related_inputs->second));
+    }
+    auto related_outputs = m_boundary.run(graph, outputs, [&](NodeId id) { return labels.mayReachAny(id, output_bounds); });
+    if (related_outputs) {
+        throw std::runtime_error("Output: " + name(related_outputs->first) + " is an ancestor of Output: " + name(related_outputs->second));
+    }
+}
+
+template class BasicDirectedGraph<std::any>;
+template class BasicGraphBuilder<std::any>;
+template class BasicCompactDirectedGraph<std::any>;
+template class BasicSubgraphView<std::any>;
+template class BasicSubgraphExtractor<std::any>;
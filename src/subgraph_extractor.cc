@@ -1,4 +1,6 @@
 #include <vector>
+#include <algorithm>
+#include <limits>
 #include <iostream>
 #include <filesystem>
 #include <unordered_map>
@@ -7,82 +9,249 @@
 #include "spdlog/spdlog.h"
 
 #include "subgraph_extractor.h"
+#include "parallel.h"
 #include "onnx.proto3.pb.h"
 
-struct HashNodeProto {
-    size_t operator()(const onnx::NodeProto& proto) const {
-        return std::hash<std::string>()(proto.name() + proto.op_type());
-    }
+namespace {
+
+// Nodes converted per thread; smaller models convert inline.
+constexpr size_t kConvertGrain = 4096;
+
+// Models a thread keeps extraction buffers for; beyond that the least
+// recently used buffers are rebound.
+constexpr size_t kWorkspacesPerThread = 4;
+
+// Marks ids in a set for the scope's lifetime and takes exactly those out
+// again, however the scope is left.
+class ScopedMembers {
+    NodeSet& m_set;
+    const std::vector<NodeId>& m_ids;
+    public:
+        ScopedMembers(NodeSet& set, const std::vector<NodeId>& ids): m_set(set), m_ids(ids) {
+            for (NodeId id: m_ids) {
+                m_set.insert(id);
+            }
+        }
+        ScopedMembers(const ScopedMembers&) = delete;
+        ScopedMembers& operator=(const ScopedMembers&) = delete;
+        ~ScopedMembers() {
+            for (NodeId id: m_ids) {
+                m_set.erase(id);
+            }
+        }
 };
 
-struct NodeProtoEqual {
-    bool operator()(const onnx::NodeProto& a, const onnx::NodeProto& b) const {
-        return a.name() == b.name() && a.op_type() == b.op_type();
+}
+
+std::atomic<uint64_t> OnnxGraphAdapter::m_next_generation{1};
+
+OnnxGraphAdapter::OnnxGraphAdapter(const onnx::GraphProto& graph):
+        m_graph(&graph), m_generation(m_next_generation.fetch_add(1, std::memory_order_relaxed)) {
+    NodeId num_nodes = graph.node_size();
+    std::unordered_map<std::string_view, NodeId> producer;
+    producer.reserve(num_nodes);
+    m_name_index.reserve(num_nodes);
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        const auto& node_proto = graph.node(id);
+        m_name_index.emplace(node_proto.name(), id);
+        for (const auto& out_vinfo_name: node_proto.output()) {
+            // "" marks an omitted optional output, which nothing can read
+            if (!out_vinfo_name.empty()) {
+                producer.emplace(out_vinfo_name, id);
+            }
+        }
     }
-};
+    // a node reading two outputs of one producer still gets a single edge
+    std::vector<NodeId> last_consumer(num_nodes, std::numeric_limits<NodeId>::max());
+    m_in_offsets.reserve(num_nodes + 1);
+    m_in_offsets.push_back(0);
+    m_out_offsets.assign(num_nodes + 1, 0);
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        for (const auto& in_vinfo_name: graph.node(id).input()) {
+            if (in_vinfo_name.empty()) {
+                continue;
+            }
+            auto iter = producer.find(in_vinfo_name);
+            if (iter != producer.end() && last_consumer[iter->second] != id) {
+                last_consumer[iter->second] = id;
+                m_producers.push_back(iter->second);
+                m_out_offsets[iter->second + 1]++;
+            }
+        }
+        m_in_offsets.push_back(m_producers.size());
+    }
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        m_out_offsets[id + 1] += m_out_offsets[id];
+    }
+    // consumers come out in id order since nodes are visited in id order
+    m_consumers.resize(m_producers.size());
+    std::vector<uint32_t> fill(m_out_offsets.begin(), m_out_offsets.end() - 1);
+    bool in_order = true;
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        for (NodeId from: inbound(id)) {
+            m_consumers[fill[from]++] = id;
+            in_order = in_order && from < id;
+        }
+    }
+    if (in_order) {
+        return;
+    }
+    // Kahn's algorithm; on a cycle every rank stays 0, which prunes nothing
+    m_rank.assign(num_nodes, 0);
+    std::vector<uint32_t> in_degree(num_nodes);
+    std::vector<NodeId> ready;
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        in_degree[id] = inbound(id).size();
+        if (in_degree[id] == 0) {
+            ready.push_back(id);
+        }
+    }
+    for (size_t head = 0; head < ready.size(); ++head) {
+        m_rank[ready[head]] = head;
+        for (NodeId next: outbound(ready[head])) {
+            if (--in_degree[next] == 0) {
+                ready.push_back(next);
+            }
+        }
+    }
+    if (ready.size() < num_nodes) {
+        std::fill(m_rank.begin(), m_rank.end(), 0);
+    }
+}
 
-OnnxModel::OnnxModel(std::filesystem::path fpath): NNModel() {
-    m_graph = convert(fpath);
+std::vector<NodeId> OnnxGraphAdapter::idsByName(const std::vector<std::string>& names) const {
+    std::vector<NodeId> ids;
+    ids.reserve(names.size());
+    std::string missing;
+    for (const auto& name: names) {
+        auto iter = m_name_index.find(name);
+        if (iter == m_name_index.end()) {
+            missing += missing.empty() ? name : ", " + name;
+            continue;
+        }
+        ids.push_back(iter->second);
+    }
+    if (!missing.empty()) {
+        throw std::runtime_error("Couldn't find nodes with names: " + missing);
+    }
+    return ids;
 }
 
-OnnxModel::OnnxModel(std::unique_ptr<onnx::ModelProto> model_proto): NNModel() {
-    m_graph = convert(std::move(model_proto));
+OnnxModel::OnnxModel(std::filesystem::path fpath): NNModel() {
+    index(load(fpath));
 }
 
-std::unique_ptr<DirectedGraph> OnnxModel::convert(std::filesystem::path fpath) {
-    return convert(load(fpath));
+OnnxModel::OnnxModel(std::unique_ptr<onnx::ModelProto> model_proto): NNModel() {
+    index(std::move(model_proto));
 }
 
-std::unique_ptr<DirectedGraph> OnnxModel::convert(std::unique_ptr<onnx::ModelProto> model_proto) {
+void OnnxModel::index(std::unique_ptr<onnx::ModelProto> model_proto) {
     m_model_proto = std::move(model_proto);
     auto& graph = m_model_proto->graph();
     for (auto& vinfo: graph.value_info()) {
-        m_vinfo_map[vinfo.name()] = vinfo;
+        m_vinfo_map[vinfo.name()] = &vinfo;
     }
 
     for (auto& tensor_proto: graph.initializer()) {
-        m_init_map[tensor_proto.name()] = tensor_proto;
+        m_init_map[tensor_proto.name()] = &tensor_proto;
     }
 
-    std::unordered_map<std::string, std::vector<onnx::NodeProto>> vinfo_consumers;
     for (auto& node_proto: graph.node()) {
         if (node_proto.op_type() == "Constant") {
-            m_const_map[node_proto.name()] = node_proto;
-        }
-        for (auto& in_vinfo_name: node_proto.input()) {
-            vinfo_consumers[in_vinfo_name].push_back(node_proto);
+            m_const_nodes.insert(node_proto.name());
         }
     }
-    auto converted = std::make_unique<DirectedGraph>();
-    std::unordered_map<onnx::NodeProto, PtrNode, HashNodeProto, NodeProtoEqual> clone_map;
-    for (auto& node_proto: graph.node()) {
-        if (clone_map.find(node_proto) == clone_map.end()) {
-            clone_map[node_proto] = std::make_shared<Node>(node_proto, node_proto.name());
-        }
-        converted->addNode(clone_map[node_proto]);
-        for (auto& out_vinfo_name: node_proto.output()) {
-            for (auto& out_node_proto: vinfo_consumers[out_vinfo_name]) {
-                if (clone_map.find(out_node_proto) == clone_map.end()) {
-                    clone_map[out_node_proto] = std::make_shared<Node>(out_node_proto, out_node_proto.name());
-                }
-                converted->addEdge(clone_map[node_proto], clone_map[out_node_proto]);
+    m_adapter = std::make_unique<OnnxGraphAdapter>(graph);
+}
+
+OnnxGraph* OnnxModel::graph() {
+    std::call_once(m_graph_once, [this] { m_graph = convert(); });
+    return m_graph.get();
+}
+
+std::unique_ptr<OnnxGraph> OnnxModel::convert() const {
+    const OnnxGraphAdapter& adapter = *m_adapter;
+    BasicGraphBuilder<onnx::NodeProto> builder(adapter.size());
+    // every NodeProto is copied into the graph, so blocks of nodes are filled on separate threads
+    parallelFor(adapter.size(), 0, kConvertGrain, [&](size_t begin, size_t end, unsigned) {
+        auto shard = builder.shard();
+        for (NodeId id = begin; id < end; ++id) {
+            shard.createNode(id, adapter.node(id), adapter.node(id).name());
+            for (NodeId producer: adapter.inbound(id)) {
+                shard.addEdge(producer, id);
             }
         }
-    }
-    assert(graph.node().size() ==  converted->nodes().size());
+        builder.merge(std::move(shard));
+    });
+    auto converted = builder.build();
+    assert(adapter.size() == converted->nodes().size());
     return converted;
 }
 
-onnx::ValueInfoProto OnnxModel::getValueInfo(const std::string& vinfo_name) {
-    return m_vinfo_map.at(vinfo_name);
+const onnx::ValueInfoProto* OnnxModel::findValueInfo(std::string_view vinfo_name) const {
+    auto iter = m_vinfo_map.find(vinfo_name);
+    return iter != m_vinfo_map.end() ? iter->second : nullptr;
+}
+
+const onnx::TensorProto* OnnxModel::findTensorProto(std::string_view tensor_name) const {
+    auto iter = m_init_map.find(tensor_name);
+    return iter != m_init_map.end() ? iter->second : nullptr;
+}
+
+const onnx::ValueInfoProto& OnnxModel::getValueInfo(const std::string& vinfo_name) const {
+    return *m_vinfo_map.at(vinfo_name);
+}
+
+bool OnnxModel::isConst(std::string_view node_name) const {
+    return m_const_nodes.find(node_name) != m_const_nodes.end();
+}
+
+const RegionFinder& OnnxModel::regions() const {
+    std::call_once(m_regions_once, [this] {
+        const OnnxGraphAdapter& graph = *m_adapter;
+        const onnx::GraphProto& graph_proto = m_model_proto->graph();
+        // a graph input is a value no node produces that isn't an initializer
+        std::vector<NodeId> entries;
+        for (NodeId id = 0; id < graph.size(); ++id) {
+            if (!graph.inbound(id).empty()) {
+                continue;
+            }
+            const auto& inputs = graph.node(id).input();
+            if (std::any_of(inputs.begin(), inputs.end(), [this](const std::string& name) { return !name.empty() && findTensorProto(name) == nullptr; })) {
+                entries.push_back(id);
+            }
+        }
+        std::unordered_set<std::string_view> graph_outputs;
+        for (const auto& vinfo: graph_proto.output()) {
+            graph_outputs.insert(vinfo.name());
+        }
+        std::vector<NodeId> exits;
+        for (NodeId id = 0; id < graph.size(); ++id) {
+            const auto& outputs = graph.node(id).output();
+            if (graph.outbound(id).empty() || std::any_of(outputs.begin(), outputs.end(), [&graph_outputs](const std::string& name) { return graph_outputs.count(name) != 0; })) {
+                exits.push_back(id);
+            }
+        }
+        BasicGraphTraversal<OnnxGraphAdapter> outward(graph);
+        outward.run(entries, {Direction::out}, [](NodeId, uint32_t) { return true; });
+        m_side_inputs.reset(graph.size());
+        for (NodeId id = 0; id < graph.size(); ++id) {
+            if (!outward.visited(id)) {
+                m_side_inputs.insert(id);
+            }
+        }
+        m_regions = std::make_unique<RegionFinder>(graph, entries, exits);
+    });
+    return *m_regions;
 }
 
-bool OnnxModel::isConst(const std::string& node_name) const {
-    return m_const_map.find(node_name) != m_const_map.end();
+bool OnnxModel::isSideInput(NodeId id) const {
+    regions();
+    return m_side_inputs.contains(id);
 }
 
-onnx::TensorProto OnnxModel::getTensorProto(const std::string& tensor_name) {
-    return m_init_map.at(tensor_name);
+const onnx::TensorProto& OnnxModel::getTensorProto(const std::string& tensor_name) const {
+    return *m_init_map.at(tensor_name);
 }
 
 std::unique_ptr<onnx::ModelProto> OnnxModel::load(std::filesystem::path fpath) {
@@ -99,116 +268,157 @@ std::unique_ptr<onnx::ModelProto> OnnxModel::load(std::filesystem::path fpath) {
     return model;
 }
 
-std::unique_ptr<NNModel> OnnxSubgraphExtractor::extract(const std::vector<std::string>& inputs, const std::vector<std::string>& outputs) {
-    std::vector<PtrNode> input_nodes;
+OnnxSubgraphExtractor::Workspace& OnnxSubgraphExtractor::workspace() const {
+    // A few per thread, most recently used first, so a thread taking turns
+    // between models doesn't rebind on every call. Keyed by generation: a
+    // new model may sit at a freed one's address.
+    thread_local std::vector<std::unique_ptr<Workspace>> workspaces;
+    const OnnxGraphAdapter& graph = m_model->adapter();
+    auto iter = std::find_if(workspaces.begin(), workspaces.end(), [&graph](const std::unique_ptr<Workspace>& workspace) {
+        return workspace->generation == graph.generation();
+    });
+    if (iter == workspaces.end()) {
+        if (workspaces.size() < kWorkspacesPerThread) {
+            workspaces.push_back(std::make_unique<Workspace>(graph));
+        }
+        else {
+            workspaces.back()->bind(graph);
+        }
+        iter = workspaces.end() - 1;
+    }
+    std::rotate(workspaces.begin(), iter, iter + 1);
+    return *workspaces.front();
+}
+
+std::unique_ptr<NNModel<onnx::NodeProto>> OnnxSubgraphExtractor::extract(const std::vector<std::string>& inputs, const std::vector<std::string>& outputs) const {
+    const OnnxGraphAdapter& graph = m_model->adapter();
+    std::vector<NodeId> input_ids;
     if (inputs.empty()) {
-        auto top_nodes = m_model->graph()->top();
-        for (auto& node: top_nodes) {
-            if (m_model->isConst(node->name())) {
+        for (NodeId id: topIds(graph)) {
+            if (m_model->isConst(graph.node(id).name())) {
                 continue;
             }
-            input_nodes.push_back(node);
+            input_ids.push_back(id);
         }
     }
-    std::vector<PtrNode> output_nodes;
+    std::vector<NodeId> output_ids;
     if (outputs.empty()) {
-        output_nodes = m_model->graph()->bottom();
+        output_ids = bottomIds(graph);
     }
-    for (const auto& name: inputs) {
-        auto node_opt = m_model->graph()->nodeByName(name);
-        if (!node_opt.has_value()) {
-            throw std::runtime_error("Couldn't find node with name: " + name);
-        }
-        input_nodes.push_back(node_opt.value());
+    std::vector<std::string> boundary_names(inputs.begin(), inputs.end());
+    boundary_names.insert(boundary_names.end(), outputs.begin(), outputs.end());
+    auto boundary_ids = graph.idsByName(boundary_names);
+    input_ids.insert(input_ids.end(), boundary_ids.begin(), boundary_ids.begin() + inputs.size());
+    output_ids.insert(output_ids.end(), boundary_ids.begin() + inputs.size(), boundary_ids.end());
+    Workspace& workspace = this->workspace();
+    // Defaulted sides are sources and sinks, which share no path. Named
+    // outputs need only be reachable from some source, Constants included,
+    // and no sink needs to be: one fed only by Constants is still selected.
+    std::vector<NodeId> sources;
+    if (inputs.empty() && !outputs.empty()) {
+        sources = topIds(graph);
     }
-    for (const auto& name: outputs) {
-        auto node_opt = m_model->graph()->nodeByName(name);
-        if (!node_opt.has_value()) {
-            throw std::runtime_error("Couldn't find node with name: " + name);
+    validateBoundary(graph, inputs.empty() ? sources : input_ids, outputs.empty() ? sources : output_ids, workspace.boundary,
+            [&graph](NodeId id) { return graph.rank(id); });
+    collectSubgraph(workspace.outward, workspace.inward, input_ids, output_ids, workspace.nodes);
+    ScopedMembers members(workspace.members, workspace.nodes);
+    return makeSubmodel(workspace.nodes, workspace.members);
+}
+
+std::unique_ptr<NNModel<onnx::NodeProto>> OnnxSubgraphExtractor::extractRegion(const SeseRegion& region) const {
+    const OnnxGraphAdapter& graph = m_model->adapter();
+    checkRegion(region, graph.size());
+    Workspace& workspace = this->workspace();
+    std::vector<NodeId>& nodes = workspace.nodes;
+    collectSubgraph(workspace.outward, workspace.inward, {region.entry}, {region.exit}, nodes);
+    ScopedMembers members(workspace.members, nodes);
+    // constants feeding the block come along, or the submodel would miss them
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        for (NodeId from: graph.inbound(nodes[i])) {
+            if (!workspace.members.contains(from) && m_model->isSideInput(from)) {
+                workspace.members.insert(from);
+                nodes.push_back(from);
+            }
         }
-        output_nodes.push_back(node_opt.value());
-    }
-    auto subgraph = m_sgex.extract(input_nodes, output_nodes);
-    spdlog::debug("Extracted edges:");
-    for (const auto& e: subgraph->edges()) {
-        spdlog::debug(e.from->name() + "->" + e.to->name());
     }
+    std::sort(nodes.begin(), nodes.end());
+    return makeSubmodel(nodes, workspace.members);
+}
 
-    std::vector<onnx::NodeProto> node_protos;
-    for (auto node: subgraph->nodes()) {
-        node_protos.push_back(std::any_cast<onnx::NodeProto>(node->data()));
+std::unique_ptr<NNModel<onnx::NodeProto>> OnnxSubgraphExtractor::extractRegion(const std::string& node_name) const {
+    NodeId id = m_model->adapter().idsByName({node_name}).front();
+    auto region = m_model->regions().smallestRegion(id);
+    if (!region.has_value()) {
+        throw std::runtime_error("Node: " + node_name + " is not inside a single-entry/single-exit region");
     }
+    return extractRegion(region.value());
+}
 
-    std::vector<onnx::ValueInfoProto> value_info_protos, input_protos, output_protos;
-    std::unordered_set<std::string> done_vinfo;
-    for (auto& node: node_protos) {
-        for (auto& vinfo_name: node.input()) {
-            onnx::ValueInfoProto vinfo_proto;
-            try {
-                vinfo_proto = m_model->getValueInfo(vinfo_name);
-            }
-            catch (const std::out_of_range& e) {
-                continue;
-            }
-            if (done_vinfo.find(vinfo_name) == done_vinfo.end()) {
-                value_info_protos.push_back(vinfo_proto);
-                done_vinfo.insert(vinfo_name);
-            }
-        }
-        for (auto& vinfo_name: node.output()) {
-            onnx::ValueInfoProto vinfo_proto;
-            try {
-                vinfo_proto = m_model->getValueInfo(vinfo_name);
-            }
-            catch (const std::out_of_range& e) {
-                continue;
-            }
-            if (done_vinfo.find(vinfo_name) == done_vinfo.end()) {
-                value_info_protos.push_back(vinfo_proto);
-                done_vinfo.insert(vinfo_name);
+std::unique_ptr<NNModel<onnx::NodeProto>> OnnxSubgraphExtractor::makeSubmodel(const std::vector<NodeId>& nodes, const NodeSet& members) const {
+    const OnnxGraphAdapter& graph = m_model->adapter();
+    auto any_member = [&members](NodeIdRange range) {
+        return std::any_of(range.begin(), range.end(), [&members](NodeId id) { return members.contains(id); });
+    };
+    if (spdlog::should_log(spdlog::level::debug)) {
+        spdlog::debug("Extracted edges:");
+        for (NodeId id: nodes) {
+            for (NodeId next: graph.outbound(id)) {
+                if (members.contains(next)) {
+                    spdlog::debug("{}->{}", graph.node(id).name(), graph.node(next).name());
+                }
             }
         }
     }
 
-    for (auto node: subgraph->top()) {
-        auto node_proto = std::any_cast<onnx::NodeProto>(node->data());
-        for (auto& vinfo_name: node_proto.input()) {
-            onnx::ValueInfoProto vinfo_proto;
-            try {
-                vinfo_proto = m_model->getValueInfo(vinfo_name);
-            }
-            catch (const std::out_of_range& e) {
-                vinfo_proto.set_name(vinfo_name);
+    std::vector<const onnx::NodeProto*> node_protos;
+    for (NodeId id: nodes) {
+        node_protos.push_back(&graph.node(id));
+    }
+
+    std::vector<const onnx::ValueInfoProto*> value_info_protos;
+    std::vector<onnx::ValueInfoProto> input_protos, output_protos;
+    std::unordered_set<std::string_view> done_vinfo;
+    for (const onnx::NodeProto* node: node_protos) {
+        for (const auto* names: {&node->input(), &node->output()}) {
+            for (auto& vinfo_name: *names) {
+                const onnx::ValueInfoProto* vinfo_proto = m_model->findValueInfo(vinfo_name);
+                if (vinfo_proto != nullptr && done_vinfo.insert(vinfo_name).second) {
+                    value_info_protos.push_back(vinfo_proto);
+                }
             }
-            input_protos.push_back(vinfo_proto);
         }
     }
 
-    for (auto node: subgraph->bottom()) {
-        auto node_proto = std::any_cast<onnx::NodeProto>(node->data());
-        for (auto& vinfo_name: node_proto.output()) {
-            onnx::ValueInfoProto vinfo_proto;
-            try {
-                vinfo_proto = m_model->getValueInfo(vinfo_name);
+    auto boundary_value = [this](const std::string& vinfo_name) {
+        const onnx::ValueInfoProto* vinfo_proto = m_model->findValueInfo(vinfo_name);
+        if (vinfo_proto != nullptr) {
+            return *vinfo_proto;
+        }
+        onnx::ValueInfoProto named;
+        named.set_name(vinfo_name);
+        return named;
+    };
+    for (NodeId id: nodes) {
+        if (!any_member(graph.inbound(id))) {
+            for (auto& vinfo_name: graph.node(id).input()) {
+                input_protos.push_back(boundary_value(vinfo_name));
             }
-            catch (const std::out_of_range& e) {
-                vinfo_proto.set_name(vinfo_name);
+        }
+    }
+    for (NodeId id: nodes) {
+        if (!any_member(graph.outbound(id))) {
+            for (auto& vinfo_name: graph.node(id).output()) {
+                output_protos.push_back(boundary_value(vinfo_name));
             }
-            output_protos.push_back(vinfo_proto);
         }
     }
 
-    std::vector<onnx::TensorProto> inits;
-    for (auto& node: node_protos) {
-        for (auto& vinfo_name: node.input()) {
-            onnx::TensorProto tensor_proto;
-            try {
-                tensor_proto = m_model->getTensorProto(vinfo_name);
+    std::vector<const onnx::TensorProto*> inits;
+    for (const onnx::NodeProto* node: node_protos) {
+        for (auto& vinfo_name: node->input()) {
+            if (const onnx::TensorProto* tensor_proto = m_model->findTensorProto(vinfo_name)) {
+                inits.push_back(tensor_proto);
             }
-            catch (const std::out_of_range& e) {
-                continue;
-            }
-            inits.push_back(tensor_proto);
         }
     }
 
@@ -216,22 +426,22 @@ std::unique_ptr<NNModel> OnnxSubgraphExtractor::extract(const std::vector<std::s
     return std::make_unique<OnnxModel>(std::move(new_model));
 }
 
-std::unique_ptr<onnx::ModelProto> OnnxModel::makeModel(const std::vector<onnx::NodeProto>& nodes,
-        const std::vector<onnx::ValueInfoProto>& values,
+std::unique_ptr<onnx::ModelProto> OnnxModel::makeModel(const std::vector<const onnx::NodeProto*>& nodes,
+        const std::vector<const onnx::ValueInfoProto*>& values,
         const std::vector<onnx::ValueInfoProto>& inputs,
         const std::vector<onnx::ValueInfoProto>& outputs,
-        const std::vector<onnx::TensorProto>& inits) {
+        const std::vector<const onnx::TensorProto*>& inits) const {
     auto model_proto = std::make_unique<onnx::ModelProto>();
     model_proto->set_producer_name("ME");
     onnx::GraphProto* graph_proto = model_proto->mutable_graph();
     graph_proto->set_name("MY GRAPH");
     for (const auto& node: nodes) {
         onnx::NodeProto* node_proto = graph_proto->add_node();
-        node_proto->CopyFrom(node);
+        node_proto->CopyFrom(*node);
     }
-    for (const auto& vinfo: values) {
+    for (const auto* vinfo: values) {
         onnx::ValueInfoProto* vinfo_proto = graph_proto->add_value_info();
-        vinfo_proto->CopyFrom(vinfo);
+        vinfo_proto->CopyFrom(*vinfo);
     }
     for (const auto& vinfo: inputs) {
         onnx::ValueInfoProto* vinfo_proto = graph_proto->add_input();
@@ -241,14 +451,14 @@ std::unique_ptr<onnx::ModelProto> OnnxModel::makeModel(const std::vector<onnx::N
         onnx::ValueInfoProto* vinfo_proto = graph_proto->add_output();
         vinfo_proto->CopyFrom(vinfo);
     }
-    for (const auto& tensor: inits) {
+    for (const auto* tensor: inits) {
         onnx::TensorProto* tensor_proto = graph_proto->add_initializer();
-        tensor_proto->CopyFrom(tensor);
+        tensor_proto->CopyFrom(*tensor);
     }
     return model_proto;
 }
 
-void OnnxModel::save(std::filesystem::path fpath) {
+void OnnxModel::save(std::filesystem::path fpath) const {
     std::string serialized; 
     m_model_proto->SerializeToString(&serialized);
     std::ofstream ofs(fpath.c_str(), std::ios::binary | std::ios::out);
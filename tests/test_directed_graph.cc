@@ -1,5 +1,6 @@
 #include "graph.h"
 #include <gtest/gtest.h>
+#include <thread>
 
 TEST(GraphManipulation, addNode) {
     DirectedGraph graph("g");
@@ -148,3 +149,996 @@ TEST(GraphQueries, sortedNodesCycle) {
     graph.addEdge(n2, n3);
     ASSERT_THROW(graph.nodes_sorted(), std::runtime_error);
 }
+
+TEST(CompactGraph, freeze) {
+    DirectedGraph graph("g");
+    auto n1 = std::make_shared<Node>(1);
+    auto n2 = std::make_shared<Node>(2);
+    auto n3 = std::make_shared<Node>(3);
+    auto n4 = std::make_shared<Node>(4);
+    graph.addEdge(n1, n2);
+    graph.addEdge(n1, n3);
+    graph.addEdge(n2, n4);
+    graph.addEdge(n3, n4);
+    auto compact = graph.freeze();
+    ASSERT_EQ(compact.size(), 4);
+    ASSERT_EQ(compact.numEdges(), 4);
+    ASSERT_TRUE(compact.hasNode(n4));
+    ASSERT_FALSE(compact.hasNode(std::make_shared<Node>(5)));
+    NodeId id1 = compact.id(n1).value();
+    NodeId id4 = compact.id(n4).value();
+    ASSERT_EQ(compact.node(id1), n1);
+    ASSERT_EQ(compact.outbound(id1).size(), 2);
+    ASSERT_TRUE(compact.inbound(id1).empty());
+    std::set<PtrNode> n4_inbound;
+    for (NodeId id: compact.inbound(id4)) {
+        n4_inbound.insert(compact.node(id));
+    }
+    ASSERT_EQ(n4_inbound, (std::set<PtrNode>{n2, n3}));
+    ASSERT_EQ(compact.toNodes(compact.top()), std::vector<PtrNode>{n1});
+    ASSERT_EQ(compact.toNodes(compact.bottom()), std::vector<PtrNode>{n4});
+    auto sorted_nodes = compact.toNodes(compact.nodes_sorted());
+    ASSERT_EQ(sorted_nodes.front(), n1);
+    ASSERT_EQ(sorted_nodes.back(), n4);
+}
+
+TEST(CompactGraph, sortedNodesCycle) {
+    DirectedGraph graph("g");
+    auto n1 = std::make_shared<Node>(1);
+    auto n2 = std::make_shared<Node>(2);
+    graph.addEdge(n1, n2);
+    graph.addEdge(n2, n1);
+    ASSERT_THROW(graph.freeze().nodes_sorted(), std::runtime_error);
+}
+
+TEST(GraphManipulation, highFanOut) {
+    DirectedGraph graph("g");
+    auto src = std::make_shared<Node>(0);
+    std::vector<PtrNode> sinks;
+    for (int i = 0; i < 50; ++i) {
+        sinks.push_back(std::make_shared<Node>(i + 1));
+        ASSERT_TRUE(graph.addEdge(src, sinks.back()));
+    }
+    ASSERT_FALSE(graph.addEdge(src, sinks[10]));
+    ASSERT_EQ(graph.outbound(src), sinks);
+    ASSERT_TRUE(graph.removeEdge(src, sinks[10]));
+    ASSERT_FALSE(graph.removeEdge(src, sinks[10]));
+    ASSERT_TRUE(graph.inbound(sinks[10]).empty());
+    ASSERT_EQ(graph.outbound(src).size(), 49);
+    ASSERT_EQ(graph.bottom().size(), 50);
+}
+
+TEST(GraphManipulation, nodesSharedBetweenGraphs) {
+    auto a = std::make_shared<Node>(1, "a");
+    auto b = std::make_shared<Node>(2, "b");
+    auto c = std::make_shared<Node>(3, "c");
+    auto first = std::make_unique<DirectedGraph>("first");
+    first->addEdge(a, b);
+    DirectedGraph second("second");
+    second.addNode(c);
+    second.addEdge(b, a);
+    ASSERT_EQ(first->id(a).value(), 0);
+    ASSERT_EQ(first->id(b).value(), 1);
+    ASSERT_FALSE(first->hasNode(c));
+    ASSERT_EQ(second.id(c).value(), 0);
+    ASSERT_EQ(second.id(b).value(), 1);
+    ASSERT_EQ(second.id(a).value(), 2);
+    ASSERT_EQ(second.outbound(b), std::vector<PtrNode>{a});
+
+    // nodes joining after a snapshot are not part of it
+    CompactDirectedGraph snapshot = second.freeze();
+    auto d = std::make_shared<Node>(4, "d");
+    second.addEdge(c, d);
+    ASSERT_TRUE(second.hasNode(d));
+    ASSERT_FALSE(snapshot.hasNode(d));
+    ASSERT_EQ(snapshot.id(a).value(), 2);
+
+    // a node outliving the first graph it joined keeps working elsewhere
+    first.reset();
+    DirectedGraph third("third");
+    third.addEdge(a, c);
+    ASSERT_EQ(third.id(a).value(), 0);
+    ASSERT_EQ(second.id(a).value(), 2);
+    ASSERT_THROW(third.inbound(b), std::out_of_range);
+}
+
+TEST(GraphQueries, nodeByName) {
+    DirectedGraph graph("g");
+    auto a = std::make_shared<Node>(1, "a");
+    auto b = std::make_shared<Node>(2, "b");
+    auto b_dup = std::make_shared<Node>(3, "b");
+    graph.addEdge(a, b);
+    graph.addNode(b_dup);
+    ASSERT_EQ(graph.nodeByName("a").value(), a);
+    ASSERT_EQ(graph.nodeByName("b").value(), b);
+    ASSERT_FALSE(graph.nodeByName("c").has_value());
+}
+
+TEST(GraphQueries, nodesByName) {
+    DirectedGraph graph("g");
+    auto a = std::make_shared<Node>(1, "a");
+    auto b = std::make_shared<Node>(2, "b");
+    graph.addEdge(a, b);
+    ASSERT_EQ(graph.nodesByName({"b", "a"}), (std::vector<PtrNode>{b, a}));
+    try {
+        graph.nodesByName({"x", "a", "y"});
+        FAIL() << "expected missing names to throw";
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_EQ(std::string(e.what()), "Couldn't find nodes with names: x, y");
+    }
+}
+
+TEST(GraphQueries, neighborViews) {
+    DirectedGraph graph("g");
+    auto n1 = std::make_shared<Node>(1);
+    auto n2 = std::make_shared<Node>(2);
+    auto n3 = std::make_shared<Node>(3);
+    graph.addEdge(n1, n2, "x");
+    graph.addEdge(n1, n3);
+    graph.addEdge(n3, n2);
+    auto out_view = graph.outboundView(n1);
+    ASSERT_EQ(out_view.size(), 2);
+    std::vector<const Node*> out_nodes;
+    for (const Node& node: out_view) {
+        out_nodes.push_back(&node);
+    }
+    ASSERT_EQ(out_nodes, (std::vector<const Node*>{n2.get(), n3.get()}));
+    auto iter = out_view.begin();
+    ASSERT_EQ(iter.id(), graph.id(n2).value());
+    ASSERT_EQ(std::any_cast<int>(iter->data()), 2);
+    ASSERT_EQ(graph.label(iter.label()), "x");
+    ASSERT_EQ(n1.use_count(), 2); // local and the arena's adopted list only
+    for (const Node& node: graph.inboundView(n2)) {
+        ASSERT_TRUE(&node == n1.get() || &node == n3.get());
+    }
+    ASSERT_TRUE(graph.inboundView(n1).empty());
+    ASSERT_EQ(graph.node(graph.id(n3).value()), n3);
+    ASSERT_FALSE(graph.id(std::make_shared<Node>(4)).has_value());
+}
+
+TEST(GraphTraversalTests, ordersAndDepth) {
+    // n0 -> n1 -> n3, n0 -> n2 -> n3 -> n4
+    DirectedGraph graph("g");
+    std::vector<PtrNode> n;
+    for (int i = 0; i < 5; ++i) {
+        n.push_back(std::make_shared<Node>(i));
+        graph.addNode(n.back());
+    }
+    graph.addEdge(n[0], n[1]);
+    graph.addEdge(n[0], n[2]);
+    graph.addEdge(n[1], n[3]);
+    graph.addEdge(n[2], n[3]);
+    graph.addEdge(n[3], n[4]);
+    auto compact = graph.freeze();
+    GraphTraversal traversal(compact);
+    std::vector<NodeId> order;
+    std::vector<uint32_t> depths;
+    auto record = [&](NodeId id, uint32_t depth) { order.push_back(id); depths.push_back(depth); return true; };
+
+    ASSERT_TRUE(traversal.run({0}, {Direction::out, TraversalOrder::bfs}, record));
+    ASSERT_EQ(order, (std::vector<NodeId>{0, 1, 2, 3, 4}));
+    ASSERT_EQ(depths, (std::vector<uint32_t>{0, 1, 1, 2, 3}));
+
+    traversal.reset();
+    order.clear();
+    depths.clear();
+    ASSERT_TRUE(traversal.run({0}, {Direction::out, TraversalOrder::dfs}, record));
+    ASSERT_EQ(order, (std::vector<NodeId>{0, 1, 3, 4, 2}));
+
+    traversal.reset();
+    order.clear();
+    ASSERT_TRUE(traversal.run({0}, {Direction::out, TraversalOrder::bfs, 1}, record));
+    ASSERT_EQ(order, (std::vector<NodeId>{0, 1, 2}));
+
+    traversal.reset();
+    order.clear();
+    ASSERT_TRUE(traversal.run({4}, {Direction::in, TraversalOrder::dfs}, record));
+    ASSERT_EQ(order.size(), 5);
+
+    traversal.reset();
+    traversal.markVisited(3);
+    order.clear();
+    ASSERT_TRUE(traversal.run({1}, {Direction::bi, TraversalOrder::dfs}, record));
+    ASSERT_EQ(order, (std::vector<NodeId>{1, 0, 2}));
+}
+
+TEST(GraphTraversalTests, earlyTermination) {
+    DirectedGraph graph("g");
+    std::vector<PtrNode> n;
+    for (int i = 0; i < 10; ++i) {
+        n.push_back(std::make_shared<Node>(i));
+        if (i > 0) {
+            graph.addEdge(n[i - 1], n[i]);
+        }
+    }
+    auto compact = graph.freeze();
+    GraphTraversal traversal(compact);
+    size_t visits = 0;
+    NodeId target = compact.id(n[4]).value();
+    ASSERT_FALSE(traversal.run({compact.id(n[0]).value()}, {}, [&](NodeId id, uint32_t) { visits++; return id != target; }));
+    ASSERT_EQ(visits, 5);
+    ASSERT_FALSE(traversal.visited(compact.id(n[5]).value()));
+}
+
+TEST(GraphTraversalTests, resetIsGenerational) {
+    DirectedGraph graph("g");
+    auto a = std::make_shared<Node>(0);
+    auto b = std::make_shared<Node>(1);
+    graph.addEdge(a, b);
+    auto compact = graph.freeze();
+    GraphTraversal traversal(compact);
+    for (int i = 0; i < 3; ++i) {
+        size_t visits = 0;
+        traversal.reset();
+        ASSERT_FALSE(traversal.visited(0));
+        traversal.run({0}, {}, [&](NodeId, uint32_t) { visits++; return true; });
+        ASSERT_EQ(visits, 2);
+        ASSERT_TRUE(traversal.visited(1));
+    }
+    ASSERT_TRUE(traversal.markVisited(1) == false);
+}
+
+TEST(GraphManipulation, highDegreeEdgeIndex) {
+    DirectedGraph graph("g");
+    auto hub = std::make_shared<Node>(0);
+    auto sink = std::make_shared<Node>(1);
+    std::vector<PtrNode> others;
+    for (int i = 0; i < 20000; ++i) {
+        others.push_back(std::make_shared<Node>(i + 2));
+        ASSERT_TRUE(graph.addEdge(hub, others.back()));
+        ASSERT_TRUE(graph.addEdge(others.back(), sink));
+    }
+    for (int i = 0; i < 20000; i += 7) {
+        ASSERT_FALSE(graph.addEdge(hub, others[i]));
+        ASSERT_FALSE(graph.addEdge(others[i], sink));
+    }
+    for (int i = 0; i < 20000; i += 2) {
+        ASSERT_TRUE(graph.removeEdge(hub, others[i]));
+        ASSERT_TRUE(graph.removeEdge(others[i], sink));
+    }
+    for (int i = 0; i < 20000; i += 2) {
+        ASSERT_FALSE(graph.removeEdge(hub, others[i]));
+    }
+    ASSERT_EQ(graph.outboundView(hub).size(), 10000);
+    ASSERT_EQ(graph.inboundView(sink).size(), 10000);
+    std::set<const Node*> remaining;
+    for (const Node& node: graph.outboundView(hub)) {
+        remaining.insert(&node);
+    }
+    for (int i = 0; i < 20000; ++i) {
+        ASSERT_EQ(remaining.count(others[i].get()), i % 2);
+        ASSERT_EQ(graph.inboundView(others[i]).size(), i % 2);
+    }
+    for (int i = 0; i < 20000; i += 2) {
+        ASSERT_TRUE(graph.addEdge(hub, others[i]));
+    }
+    ASSERT_EQ(graph.outboundView(hub).size(), 20000);
+    ASSERT_EQ(graph.edges().size(), 30000);
+}
+
+TEST(GraphBuilderTests, bulkEdges) {
+    std::vector<PtrNode> n;
+    GraphBuilder builder(4, "built");
+    for (NodeId id = 0; id < 4; ++id) {
+        n.push_back(std::make_shared<Node>(int(id)));
+        builder.setNode(id, n.back());
+    }
+    builder.addEdges({{0, 2, "x"}, {0, 1, ""}, {1, 3, ""}, {0, 2, "y"}, {2, 3, ""}});
+    builder.addEdge(0, 1);
+    auto graph = builder.build();
+    ASSERT_EQ(graph->nodes(), n);
+    ASSERT_EQ(graph->edges().size(), 4);
+    ASSERT_EQ(graph->outbound(n[0]), (std::vector<PtrNode>{n[1], n[2]}));
+    ASSERT_EQ(graph->inbound(n[3]), (std::vector<PtrNode>{n[1], n[2]}));
+    auto out_iter = graph->outboundView(n[0]).begin();
+    ++out_iter;
+    ASSERT_EQ(graph->label(out_iter.label()), "x");
+    ASSERT_FALSE(graph->addEdge(n[0], n[2]));
+    ASSERT_EQ(graph->nodes_sorted().front(), n[0]);
+}
+
+TEST(GraphBuilderTests, highFanOut) {
+    GraphBuilder builder(1001);
+    std::vector<PtrNode> n;
+    for (NodeId id = 0; id <= 1000; ++id) {
+        n.push_back(std::make_shared<Node>(int(id)));
+        builder.setNode(id, n.back());
+        if (id > 0) {
+            builder.addEdge(0, id);
+            builder.addEdge(0, id);
+        }
+    }
+    auto graph = builder.build();
+    ASSERT_EQ(graph->outboundView(n[0]).size(), 1000);
+    ASSERT_FALSE(graph->addEdge(n[0], n[500]));
+    ASSERT_TRUE(graph->removeEdge(n[0], n[500]));
+    ASSERT_EQ(graph->outboundView(n[0]).size(), 999);
+}
+
+TEST(GraphBuilderTests, invalidInput) {
+    GraphBuilder unset(2);
+    unset.setNode(0, std::make_shared<Node>(0));
+    ASSERT_THROW(unset.build(), std::runtime_error);
+    GraphBuilder duplicate(2);
+    auto n = std::make_shared<Node>(0);
+    duplicate.setNode(0, n);
+    duplicate.setNode(1, n);
+    ASSERT_THROW(duplicate.build(), std::runtime_error);
+    ASSERT_THROW(duplicate.addEdge(0, 2), std::out_of_range);
+}
+
+TEST(GraphBuilderTests, buildsOnce) {
+    GraphBuilder builder(2);
+    builder.createNode(0, 0, "a");
+    builder.createNode(1, 1, "b");
+    builder.addEdge(0, 1, "x");
+    auto graph = builder.build();
+    try {
+        builder.build();
+        FAIL() << "expected a second build() to throw";
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "GraphBuilder has already built its graph");
+    }
+    // the graph built first is unaffected
+    ASSERT_EQ(graph->edges().size(), 1);
+    ASSERT_EQ(graph->label(graph->outboundView(0).begin().label()), "x");
+}
+
+TEST(GraphBuilderTests, shardsBuildConcurrently) {
+    // a layered graph: node i feeds i + 1 and i + 7, every third node unnamed
+    const NodeId num_nodes = 4000;
+    const unsigned num_threads = 4;
+    auto fill = [&](auto& target, NodeId begin, NodeId end) {
+        for (NodeId id = begin; id < end; ++id) {
+            if (id % 3 == 0) {
+                target.createNode(id, int(id));
+            }
+            else {
+                target.createNode(id, int(id), "n" + std::to_string(id));
+            }
+            if (id + 1 < num_nodes) {
+                target.addEdge(id, id + 1, id % 2 == 0 ? "even" : "");
+            }
+            if (id + 7 < num_nodes) {
+                target.addEdge(id, id + 7);
+            }
+        }
+    };
+    GraphBuilder serial_builder(num_nodes);
+    fill(serial_builder, 0, num_nodes);
+    auto serial = serial_builder.build();
+
+    GraphBuilder builder(num_nodes);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < num_threads; ++t) {
+        workers.emplace_back([&, t] {
+            auto shard = builder.shard();
+            fill(shard, num_nodes * t / num_threads, num_nodes * (t + 1) / num_threads);
+            builder.merge(std::move(shard));
+        });
+    }
+    for (auto& worker: workers) {
+        worker.join();
+    }
+    auto graph = builder.build();
+    ASSERT_EQ(graph->size(), num_nodes);
+    ASSERT_EQ(graph->edges().size(), serial->edges().size());
+    for (NodeId id = 0; id + 1 < num_nodes; ++id) {
+        auto out = graph->outboundView(id).begin();
+        ASSERT_EQ(out.id(), id + 1);
+        ASSERT_EQ(graph->label(out.label()), id % 2 == 0 ? "even" : "");
+        ASSERT_EQ(std::any_cast<int>(graph->get(id).data()), int(id));
+    }
+    // names drawn from the shared counter on different threads never collide
+    std::unordered_set<std::string_view> names;
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        names.insert(graph->get(id).name());
+    }
+    ASSERT_EQ(names.size(), num_nodes);
+    ASSERT_EQ(graph->names()->size(), num_nodes);
+}
+
+TEST(NodeArenaTests, createNodesById) {
+    DirectedGraph graph("arena");
+    NodeId a = graph.createNode(1, "a");
+    NodeId b = graph.createNode(2, "b");
+    NodeId c = graph.createNode(3);
+    ASSERT_TRUE(graph.addEdge(a, b, "x"));
+    ASSERT_TRUE(graph.addEdge(b, c));
+    ASSERT_FALSE(graph.addEdge(a, b));
+    ASSERT_THROW(graph.addEdge(a, 3), std::out_of_range);
+    ASSERT_EQ(graph.get(a).name(), "a");
+    ASSERT_EQ(std::any_cast<int>(graph.get(c).data()), 3);
+    ASSERT_EQ(graph.nodeByName("b").value()->name(), "b");
+    ASSERT_EQ(graph.outbound(graph.node(a)), std::vector<PtrNode>{graph.node(b)});
+    ASSERT_TRUE(graph.removeEdge(a, b));
+    ASSERT_FALSE(graph.removeEdge(a, b));
+    ASSERT_EQ(graph.edges().size(), 1);
+}
+
+TEST(NodeArenaTests, stableAddressesAndLifetime) {
+    PtrNode first;
+    const Node* first_address = nullptr;
+    {
+        DirectedGraph graph("arena");
+        NodeId id = graph.createNode(std::string("payload"), "first");
+        first_address = &graph.get(id);
+        for (int i = 0; i < 5000; ++i) {
+            graph.addEdge(graph.createNode(i), id);
+        }
+        ASSERT_EQ(&graph.get(id), first_address);
+        first = graph.node(id);
+    }
+    // the aliasing pointer keeps the whole arena alive after the graph is gone
+    ASSERT_EQ(first.get(), first_address);
+    ASSERT_EQ(first->name(), "first");
+    ASSERT_EQ(std::any_cast<std::string>(first->data()), "payload");
+}
+
+TEST(NodeNameTests, internedOncePerGraph) {
+    DirectedGraph graph("names");
+    NodeId a = graph.createNode(1, "conv");
+    NodeId b = graph.createNode(2, std::string("conv"));
+    NodeId c = graph.createNode(3, std::string(20000, 'x'));
+    ASSERT_EQ(graph.get(a).name().data(), graph.get(b).name().data());
+    ASSERT_EQ(graph.get(c).name().size(), 20000);
+    ASSERT_EQ(graph.names()->size(), 2);
+    ASSERT_TRUE(graph.names()->contains("conv"));
+    ASSERT_EQ(graph.nodeByName(std::string_view("conv")).value().get(), &graph.get(a));
+}
+
+TEST(NodeNameTests, absorbKeepsViews) {
+    StringInterner names;
+    StringInterner shard;
+    std::string_view conv = names.intern("conv");
+    std::string_view shard_conv = shard.intern("conv");
+    std::vector<std::string_view> views;
+    for (int i = 0; i < 1000; ++i) {
+        views.push_back(shard.intern("n" + std::to_string(i)));
+    }
+    names.absorb(std::move(shard));
+    ASSERT_EQ(shard.size(), 0);
+    ASSERT_EQ(names.size(), 1001);
+    ASSERT_EQ(names.intern("conv").data(), conv.data());
+    ASSERT_EQ(shard_conv, "conv");
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(names.intern("n" + std::to_string(i)).data(), views[i].data());
+    }
+}
+
+TEST(NodeNameTests, copiesOwnTheirName) {
+    std::unique_ptr<Node> copy;
+    {
+        DirectedGraph graph("names");
+        NodeId id = graph.createNode(1, "relu");
+        copy = std::make_unique<Node>(graph.get(id));
+    }
+    ASSERT_EQ(copy->name(), "relu");
+    Node moved(std::move(*copy));
+    ASSERT_EQ(moved.name(), "relu");
+    Node standalone(std::any(2), std::string("standalone"));
+    Node standalone_moved(std::move(standalone));
+    ASSERT_EQ(standalone_moved.name(), "standalone");
+}
+
+struct OpInfo {
+    std::string op_type;
+    std::vector<int> shape;
+};
+
+TEST(TypedGraphTests, payloadIsTypedReference) {
+    BasicDirectedGraph<OpInfo> graph("typed");
+    NodeId conv = graph.createNode({"Conv", {1, 3, 224, 224}}, "conv");
+    NodeId relu = graph.createNode({"Relu", {1, 64, 112, 112}}, "relu");
+    graph.addEdge(conv, relu);
+    const OpInfo& info = graph.get(relu).data();
+    ASSERT_EQ(info.op_type, "Relu");
+    ASSERT_EQ(&info, &graph.node(relu)->data());
+    for (const auto& node: graph.outboundView(conv)) {
+        ASSERT_EQ(node.data().shape[1], 64);
+    }
+
+    BasicSubgraphExtractor<OpInfo> ex(&graph);
+    auto subgraph = ex.extract({graph.node(conv)}, {graph.node(relu)}).materialize();
+    ASSERT_EQ(subgraph->size(), 2);
+    ASSERT_EQ(subgraph->nodeByName("conv").value()->data().shape[3], 224);
+    ASSERT_EQ(subgraph->edges().size(), 1);
+}
+
+TEST(TopologicalLevelTests, levelsAndOffsets) {
+    DirectedGraph graph("g");
+    NodeId a = graph.createNode(0);
+    NodeId b = graph.createNode(1);
+    NodeId c = graph.createNode(2);
+    NodeId d = graph.createNode(3);
+    graph.addEdge(a, c);
+    graph.addEdge(b, c);
+    graph.addEdge(c, d);
+    graph.addEdge(a, d);
+    TopologicalLevels levels = graph.levels();
+    ASSERT_TRUE(levels.complete());
+    ASSERT_EQ(levels.numLevels(), 3);
+    ASSERT_EQ(levels.order, (std::vector<NodeId>{a, b, c, d}));
+    ASSERT_EQ(levels.level, (std::vector<uint32_t>{0, 0, 1, 2}));
+    ASSERT_EQ(levels.offsets, (std::vector<uint32_t>{0, 2, 3, 4}));
+    ASSERT_EQ(graph.freeze().levels().level, levels.level);
+}
+
+TEST(TopologicalLevelTests, parallelMatchesSerial) {
+    // wide enough that every level is split across threads
+    const int num_levels = 12, width = 20000;
+    DirectedGraph graph("wide");
+    graph.reserve(num_levels * width);
+    for (int i = 0; i < num_levels * width; ++i) {
+        graph.createNode(i);
+    }
+    for (int l = 0; l + 1 < num_levels; ++l) {
+        for (int i = 0; i < width; ++i) {
+            graph.addEdge(l * width + i, (l + 1) * width + (i * 7919) % width);
+            graph.addEdge(l * width + i, (l + 1) * width + (i + 1) % width);
+        }
+    }
+    auto compact = graph.freeze();
+    TopologicalLevels serial = compact.levels(1);
+    TopologicalLevels parallel = compact.levels(4);
+    ASSERT_TRUE(parallel.complete());
+    ASSERT_EQ(parallel.numLevels(), num_levels);
+    ASSERT_EQ(parallel.offsets, serial.offsets);
+    ASSERT_EQ(parallel.level, serial.level);
+    ASSERT_EQ(graph.levels(4).level, serial.level);
+    // the order itself is the same for any thread count and any run
+    ASSERT_EQ(parallel.order, serial.order);
+    ASSERT_EQ(compact.levels(3).order, serial.order);
+    ASSERT_TRUE(std::is_sorted(serial.order.begin() + serial.offsets[1], serial.order.begin() + serial.offsets[2]));
+}
+
+TEST(TopologicalLevelTests, cycleLeavesNodesUnleveled) {
+    DirectedGraph graph("g");
+    NodeId a = graph.createNode(0);
+    NodeId b = graph.createNode(1);
+    NodeId c = graph.createNode(2);
+    NodeId d = graph.createNode(3);
+    graph.addEdge(a, b);
+    graph.addEdge(b, c);
+    graph.addEdge(c, b);
+    graph.addEdge(c, d);
+    TopologicalLevels levels = graph.levels();
+    ASSERT_FALSE(levels.complete());
+    ASSERT_EQ(levels.order, std::vector<NodeId>{a});
+    ASSERT_EQ(levels.level[b], TopologicalLevels::kNoLevel);
+    ASSERT_EQ(levels.level[d], TopologicalLevels::kNoLevel);
+    ASSERT_THROW(graph.nodes_sorted(), std::runtime_error);
+}
+
+TEST(DynamicOrderTests, rejectsCycleEdge) {
+    DirectedGraph graph("g");
+    NodeId a = graph.createNode(0);
+    NodeId b = graph.createNode(1);
+    NodeId c = graph.createNode(2);
+    graph.addEdge(a, b);
+    graph.enableTopologicalOrder();
+    ASSERT_TRUE(graph.addEdge(b, c));
+    NodeId d = graph.createNode(3);
+    ASSERT_TRUE(graph.addEdge(d, a));
+    ASSERT_EQ(graph.topologicalOrder(), (std::vector<NodeId>{d, a, b, c}));
+    uint64_t version = graph.version();
+    ASSERT_THROW(graph.addEdge(c, d), std::runtime_error);
+    ASSERT_THROW(graph.addEdge(b, b), std::runtime_error);
+    ASSERT_EQ(graph.version(), version);
+    ASSERT_TRUE(graph.outbound(graph.node(c)).empty());
+    ASSERT_TRUE(graph.removeEdge(a, b));
+    ASSERT_TRUE(graph.addEdge(b, a));
+    ASSERT_LT(graph.topologicalIndex(b), graph.topologicalIndex(a));
+}
+
+TEST(DynamicOrderTests, staysValidUnderRandomEdits) {
+    const NodeId num_nodes = 300;
+    DirectedGraph graph("g");
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        graph.createNode(id);
+    }
+    graph.enableTopologicalOrder();
+    uint64_t seed = 7;
+    auto next = [&seed]() {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        return static_cast<NodeId>(seed >> 33);
+    };
+    size_t rejected = 0;
+    for (int i = 0; i < 3000; ++i) {
+        NodeId from = next() % num_nodes;
+        NodeId to = next() % num_nodes;
+        try {
+            graph.addEdge(from, to);
+        }
+        catch (const std::runtime_error&) {
+            rejected++;
+        }
+        if (i % 4 == 0) {
+            graph.removeEdge(next() % num_nodes, next() % num_nodes);
+        }
+    }
+    ASSERT_GT(rejected, 0);
+    const std::vector<NodeId>& order = graph.topologicalOrder();
+    ASSERT_EQ(order.size(), num_nodes);
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        ASSERT_EQ(order[graph.topologicalIndex(id)], id);
+        auto view = graph.outboundView(id);
+        for (auto iter = view.begin(); iter != view.end(); ++iter) {
+            ASSERT_LT(graph.topologicalIndex(id), graph.topologicalIndex(iter.id()));
+        }
+    }
+    graph.disableTopologicalOrder();
+    ASSERT_EQ(graph.sortedIds().size(), num_nodes);
+}
+
+static DirectedGraph makeRandomDag(NodeId num_nodes, int num_edges, uint64_t seed) {
+    DirectedGraph graph("g");
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        graph.createNode(id);
+    }
+    auto next = [&seed]() {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        return static_cast<NodeId>(seed >> 33);
+    };
+    for (int i = 0; i < num_edges; ++i) {
+        NodeId a = next() % num_nodes;
+        NodeId b = next() % num_nodes;
+        if (a != b) {
+            graph.addEdge(std::min(a, b), std::max(a, b));
+        }
+    }
+    return graph;
+}
+
+TEST(ReachabilityIndexTests, matchesTraversal) {
+    const NodeId num_nodes = 400;
+    DirectedGraph graph = makeRandomDag(num_nodes, 1200, 11);
+    CompactDirectedGraph compact = graph.freeze();
+    std::vector<std::vector<bool>> reaches(num_nodes, std::vector<bool>(num_nodes, false));
+    for (NodeId id = num_nodes; id-- > 0;) {
+        for (NodeId next: compact.outbound(id)) {
+            reaches[id][next] = true;
+            for (NodeId far = 0; far < num_nodes; ++far) {
+                if (reaches[next][far]) {
+                    reaches[id][far] = true;
+                }
+            }
+        }
+    }
+    ReachabilityIndex exact(compact);
+    ReachabilityIndex folded(compact, 8 * num_nodes); // one word per node
+    AncestryLabels labels(compact);
+    ASSERT_TRUE(labels.acyclic());
+    ASSERT_TRUE(exact.exact());
+    ASSERT_FALSE(folded.exact());
+    ASSERT_LT(folded.memoryBytes(), exact.memoryBytes());
+    for (NodeId a = 0; a < num_nodes; ++a) {
+        for (NodeId b = 0; b < num_nodes; ++b) {
+            ASSERT_EQ(exact.isAncestor(a, b), reaches[a][b]);
+            ASSERT_EQ(folded.isAncestor(a, b), reaches[a][b]);
+            ASSERT_EQ(labels.isAncestor(a, b), reaches[a][b]);
+        }
+    }
+    std::vector<NodeId> inputs{3, 17, 40};
+    std::vector<NodeId> outputs;
+    for (NodeId in: {3, 40}) {
+        // a reachable node halfway down the order, so some descendants are left out
+        for (NodeId id = num_nodes / 2; id < num_nodes; ++id) {
+            if (reaches[in][id]) {
+                outputs.push_back(id);
+                break;
+            }
+        }
+    }
+    std::vector<NodeId> expected;
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        bool from_input = std::any_of(inputs.begin(), inputs.end(), [&](NodeId in) { return in == id || reaches[in][id]; });
+        bool to_output = std::any_of(outputs.begin(), outputs.end(), [&](NodeId out) { return out == id || reaches[id][out]; });
+        if (from_input && to_output) {
+            expected.push_back(id);
+        }
+    }
+    ASSERT_FALSE(expected.empty());
+    ASSERT_EQ(exact.between(inputs, outputs), expected);
+    ASSERT_EQ(folded.between(inputs, outputs), expected);
+}
+
+TEST(ReachabilityIndexTests, rejectsCycles) {
+    DirectedGraph graph("g");
+    NodeId a = graph.createNode(0);
+    NodeId b = graph.createNode(1);
+    graph.addEdge(a, b);
+    graph.addEdge(b, a);
+    ASSERT_THROW(ReachabilityIndex(graph.freeze()), std::runtime_error);
+}
+
+TEST(AncestryLabelTests, cyclicGraphFallsBackToSearch) {
+    // a -> b -> c -> b, c -> d
+    DirectedGraph graph("g");
+    NodeId a = graph.createNode(0);
+    NodeId b = graph.createNode(1);
+    NodeId c = graph.createNode(2);
+    NodeId d = graph.createNode(3);
+    graph.addEdge(a, b);
+    graph.addEdge(b, c);
+    graph.addEdge(c, b);
+    graph.addEdge(c, d);
+    CompactDirectedGraph compact = graph.freeze();
+    AncestryLabels labels(compact);
+    ASSERT_FALSE(labels.acyclic());
+    ASSERT_TRUE(labels.isAncestor(c, b));
+    ASSERT_TRUE(labels.isAncestor(b, c));
+    ASSERT_TRUE(labels.isAncestor(a, d));
+    ASSERT_FALSE(labels.isAncestor(d, b));
+    ASSERT_FALSE(labels.isAncestor(b, a));
+}
+
+TEST(ParallelBfsTests, matchesSerialTraversal) {
+    // wide layers so both top-down and bottom-up levels get split across threads
+    const NodeId width = 6000;
+    const NodeId depth = 12;
+    DirectedGraph graph("g");
+    for (NodeId id = 0; id < width * depth; ++id) {
+        graph.createNode(id);
+    }
+    for (NodeId layer = 0; layer + 1 < depth; ++layer) {
+        for (NodeId i = 0; i < width; ++i) {
+            graph.addEdge(layer * width + i, (layer + 1) * width + (i * 7) % width);
+            if (i % 3 == 0) {
+                graph.addEdge(layer * width + i, (layer + 1) * width + (i * 13 + 1) % width);
+            }
+        }
+    }
+    CompactDirectedGraph compact = graph.freeze();
+    GraphTraversal serial(compact);
+    ParallelBfs parallel(compact, 4);
+    std::vector<NodeId> blocked{5 * width + 7, 6 * width + 21};
+    for (Direction direction: {Direction::out, Direction::in, Direction::bi}) {
+        std::vector<NodeId> sources;
+        NodeId first = direction == Direction::in ? (depth - 1) * width : 0;
+        for (NodeId i = 0; i < width / 2; ++i) {
+            sources.push_back(first + i);
+        }
+        serial.reset();
+        parallel.reset();
+        for (NodeId id: blocked) {
+            serial.markVisited(id);
+            parallel.markVisited(id);
+        }
+        serial.run(sources, {direction, TraversalOrder::bfs}, [](NodeId, uint32_t) { return true; });
+        parallel.run(sources, direction);
+        size_t num_visited = 0;
+        for (NodeId id = 0; id < compact.size(); ++id) {
+            ASSERT_EQ(parallel.visited(id), serial.visited(id));
+            num_visited += serial.visited(id);
+        }
+        ASSERT_GT(num_visited, width);
+    }
+}
+
+TEST(EdgeRangeTests, streamsLabeledEdges) {
+    DirectedGraph graph("g");
+    NodeId a = graph.createNode(0, "a");
+    NodeId b = graph.createNode(1, "b");
+    NodeId c = graph.createNode(2, "c");
+    graph.createNode(3, "isolated");
+    graph.addEdge(a, b, "x");
+    graph.addEdge(a, c);
+    graph.addEdge(b, c, "y");
+    std::vector<std::string> seen;
+    for (const auto& edge: graph.edgeRange()) {
+        seen.push_back(std::string(edge.from.name()) + "->" + std::string(edge.to.name()) + ":" + std::string(edge.label));
+        ASSERT_EQ(&edge.to, &graph.get(edge.to_id));
+    }
+    ASSERT_EQ(seen, (std::vector<std::string>{"a->b:x", "a->c:", "b->c:y"}));
+    ASSERT_EQ(graph.edges()[2].label, "y");
+
+    CompactDirectedGraph compact = graph.freeze();
+    size_t num_edges = 0;
+    for (const auto& edge: compact.edgeRange()) {
+        ASSERT_EQ(edge.label, edge.from_id == b ? "y" : edge.to_id == b ? "x" : "");
+        num_edges++;
+    }
+    ASSERT_EQ(num_edges, 3);
+}
+
+TEST(ComponentTests, componentsAndCycleWitness) {
+    // a -> b -> c -> b, c -> d -> e -> d, e -> f
+    DirectedGraph graph("g");
+    std::vector<NodeId> n;
+    for (const char* name: {"a", "b", "c", "d", "e", "f"}) {
+        n.push_back(graph.createNode(0, name));
+    }
+    graph.addEdge(n[0], n[1]);
+    graph.addEdge(n[1], n[2]);
+    graph.addEdge(n[2], n[1]);
+    graph.addEdge(n[2], n[3]);
+    graph.addEdge(n[3], n[4]);
+    graph.addEdge(n[4], n[3]);
+    graph.addEdge(n[4], n[5]);
+    StronglyConnectedComponents scc = graph.components();
+    ASSERT_EQ(scc.size(), 4);
+    ASSERT_EQ(scc.component[n[1]], scc.component[n[2]]);
+    ASSERT_EQ(scc.component[n[3]], scc.component[n[4]]);
+    ASSERT_LT(scc.component[n[0]], scc.component[n[1]]);
+    ASSERT_LT(scc.component[n[2]], scc.component[n[3]]);
+    ASSERT_LT(scc.component[n[4]], scc.component[n[5]]);
+    ASSERT_EQ(scc.componentSize(scc.component[n[1]]), 2);
+    ASSERT_EQ(graph.findCycle(), (std::vector<NodeId>{n[1], n[2]}));
+    try {
+        graph.nodes_sorted();
+        FAIL();
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "DirectedGraph contains a cycle: b -> c -> b");
+    }
+    ASSERT_THROW(graph.freeze().nodes_sorted(), std::runtime_error);
+    graph.removeEdge(n[2], n[1]);
+    graph.removeEdge(n[4], n[3]);
+    ASSERT_TRUE(graph.findCycle().empty());
+    ASSERT_EQ(graph.components().size(), 6);
+}
+
+TEST(ComponentTests, deepCycleDoesNotOverflow) {
+    const NodeId length = 300000;
+    DirectedGraph graph("g");
+    for (NodeId id = 0; id < length; ++id) {
+        graph.createNode(id);
+        if (id > 0) {
+            graph.addEdge(id - 1, id);
+        }
+    }
+    graph.addEdge(length - 1, 0);
+    ASSERT_EQ(graph.components().size(), 1);
+    ASSERT_EQ(graph.findCycle().size(), length);
+}
+
+TEST(ComponentTests, condenseToDag) {
+    // x -> loop body (b <-> c) -> y
+    DirectedGraph graph("g");
+    std::vector<NodeId> n;
+    for (const char* name: {"x", "b", "c", "y"}) {
+        n.push_back(graph.createNode(0, name));
+    }
+    graph.addEdge(n[0], n[1]);
+    graph.addEdge(n[1], n[2]);
+    graph.addEdge(n[2], n[1], "back");
+    graph.addEdge(n[2], n[3]);
+    auto dag = graph.condense();
+    ASSERT_EQ(dag->size(), 3);
+    ASSERT_EQ(dag->edges().size(), 2);
+    auto body = dag->nodeByName("b").value();
+    ASSERT_EQ(body->data(), (std::vector<NodeId>{n[1], n[2]}));
+    ASSERT_EQ(dag->names(), graph.names());
+    ASSERT_EQ(dag->nodes_sorted().back()->name(), "y");
+
+    BasicSubgraphExtractor<std::vector<NodeId>> ex(dag.get());
+    auto view = ex.extract({dag->nodeByName("x").value()}, {body});
+    ASSERT_EQ(view.size(), 2);
+}
+
+TEST(DominatorTests, residualBlocks) {
+    // x -> s -> {a -> b, skip} -> j -> t -> {u, v} -> w -> y
+    DirectedGraph graph("g");
+    std::vector<NodeId> n;
+    for (const char* name: {"x", "s", "a", "b", "j", "t", "u", "v", "w", "y"}) {
+        n.push_back(graph.createNode(0, name));
+    }
+    for (auto [from, to]: std::vector<std::pair<int, int>>{{0, 1}, {1, 2}, {2, 3}, {3, 4}, {1, 4}, {4, 5}, {5, 6}, {5, 7}, {6, 8}, {7, 8}, {8, 9}}) {
+        graph.addEdge(n[from], n[to]);
+    }
+    auto compact = graph.freeze();
+    RegionFinder finder(compact);
+    const auto& dom = finder.dominators();
+    const auto& pdom = finder.postDominators();
+    ASSERT_EQ(dom.idom(n[0]), DominatorTree::kRoot);
+    ASSERT_EQ(dom.idom(n[4]), n[1]);
+    ASSERT_EQ(dom.idom(n[8]), n[5]);
+    ASSERT_EQ(pdom.idom(n[1]), n[4]);
+    ASSERT_EQ(pdom.idom(n[2]), n[3]);
+    ASSERT_EQ(pdom.idom(n[9]), DominatorTree::kRoot);
+    ASSERT_TRUE(dom.dominates(n[1], n[3]));
+    ASSERT_TRUE(dom.dominates(n[3], n[3]));
+    ASSERT_FALSE(dom.dominates(n[2], n[4]));
+    ASSERT_TRUE(pdom.dominates(n[8], n[6]));
+
+    auto regions = finder.regions();
+    ASSERT_EQ(regions.size(), 2);
+    ASSERT_EQ(regions[0].entry, n[1]);
+    ASSERT_EQ(regions[0].exit, n[4]);
+    ASSERT_EQ(regions[1].entry, n[5]);
+    ASSERT_EQ(regions[1].exit, n[8]);
+    ASSERT_EQ(finder.smallestRegion(n[2])->entry, n[1]);
+    ASSERT_EQ(finder.smallestRegion(n[7])->exit, n[8]);
+    ASSERT_FALSE(finder.smallestRegion(n[0]).has_value());
+    // the mutable graph's forward-only neighbor ranges give the same answer
+    RegionFinder live(graph);
+    ASSERT_EQ(live.regions().size(), 2);
+    ASSERT_EQ(live.dominators().idom(n[8]), n[5]);
+    ASSERT_EQ(live.postDominators().idom(n[2]), n[3]);
+
+    // a second source feeding the join opens the first block
+    graph.addEdge(graph.createNode(0, "z"), n[4]);
+    auto reopened = graph.freeze();
+    RegionFinder open_finder(reopened);
+    ASSERT_EQ(open_finder.regions().size(), 1);
+    ASSERT_FALSE(open_finder.smallestRegion(n[2]).has_value());
+}
+
+// A bare adjacency list: the algorithms should need nothing but GraphTraits.
+struct AdjacencyLists {
+    std::vector<std::vector<NodeId>> in;
+    std::vector<std::vector<NodeId>> out;
+    std::vector<std::string> names;
+    NodeId add(const std::string& name) {
+        in.emplace_back();
+        out.emplace_back();
+        names.push_back(name);
+        return names.size() - 1;
+    }
+    void link(NodeId from, NodeId to) {
+        out[from].push_back(to);
+        in[to].push_back(from);
+    }
+};
+
+template <>
+struct GraphTraits<AdjacencyLists> {
+    using NodeHandle = const std::string*;
+    static size_t idBound(const AdjacencyLists& graph) { return graph.names.size(); }
+    static IdSequence nodes(const AdjacencyLists& graph) { return graph.names.size(); }
+    static const std::vector<NodeId>& inbound(const AdjacencyLists& graph, NodeId id) { return graph.in[id]; }
+    static const std::vector<NodeId>& outbound(const AdjacencyLists& graph, NodeId id) { return graph.out[id]; }
+    static NodeHandle node(const AdjacencyLists& graph, NodeId id) { return &graph.names[id]; }
+    static std::string_view nodeName(const AdjacencyLists& graph, NodeId id) { return graph.names[id]; }
+};
+
+TEST(GraphTraitsTests, algorithmsRunOnAnyAdjacency) {
+    // a -> b -> d, a -> c -> d, plus a dead end c -> x
+    AdjacencyLists graph;
+    std::vector<NodeId> n;
+    for (const char* name: {"a", "b", "c", "d", "x"}) {
+        n.push_back(graph.add(name));
+    }
+    graph.link(n[0], n[1]);
+    graph.link(n[0], n[2]);
+    graph.link(n[1], n[3]);
+    graph.link(n[2], n[3]);
+    graph.link(n[2], n[4]);
+    ASSERT_EQ(topIds(graph), (std::vector<NodeId>{n[0]}));
+    ASSERT_EQ(bottomIds(graph), (std::vector<NodeId>{n[3], n[4]}));
+    ASSERT_EQ(sortedIds(graph), (std::vector<NodeId>{n[0], n[1], n[2], n[3], n[4]}));
+    ASSERT_EQ(collectSubgraph(graph, {n[2]}, {n[4]}), (std::vector<NodeId>{n[2], n[3], n[4]}));
+
+    std::vector<NodeId> order;
+    BasicGraphTraversal<AdjacencyLists> traversal(graph);
+    traversal.run({n[3]}, {Direction::bi}, [&order](NodeId id, uint32_t) {
+        order.push_back(id);
+        return true;
+    });
+    ASSERT_EQ(order, (std::vector<NodeId>{n[3], n[1], n[0], n[2], n[4]}));
+
+    // one sweep reused: marks from an earlier call must not leak into the next
+    BoundarySweep sweep;
+    validateBoundary(graph, {n[1], n[2]}, {n[3], n[4]}, sweep);
+    ASSERT_THROW(validateBoundary(graph, {n[1]}, {n[4]}, sweep), std::runtime_error);
+    try {
+        validateBoundary(graph, {n[3], n[0]}, {n[4]}, sweep);
+        FAIL();
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "Input: a is an ancestor of Input: d");
+    }
+
+    graph.link(n[3], n[2]);
+    ASSERT_EQ(stronglyConnectedComponents(graph).size(), 4);
+    try {
+        sortedIds(graph);
+        FAIL();
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "DirectedGraph contains a cycle: c -> d -> c");
+    }
+}
@@ -0,0 +1,53 @@
+#include "node_set.h"
+#include <gtest/gtest.h>
+#include <set>
+
+TEST(NodeSetTests, insertEraseCount) {
+    NodeSet set(200);
+    ASSERT_TRUE(set.empty());
+    for (NodeId id: {0, 63, 64, 130, 199}) {
+        set.insert(id);
+    }
+    set.insert(64);
+    ASSERT_EQ(set.count(), 5);
+    ASSERT_TRUE(set.contains(130));
+    ASSERT_FALSE(set.contains(131));
+    ASSERT_FALSE(set.contains(500));
+    set.erase(63);
+    ASSERT_EQ(set.toVector(), (std::vector<NodeId>{0, 64, 130, 199}));
+    set.clear();
+    ASSERT_TRUE(set.empty());
+    ASSERT_EQ(set.begin(), set.end());
+}
+
+TEST(NodeSetTests, setAlgebraMatchesStdSet) {
+    // odd universe so the vector loops leave a scalar tail
+    const size_t universe = 1000 * 64 + 37;
+    std::set<NodeId> a_ref, b_ref;
+    NodeSet a(universe), b(universe);
+    uint64_t seed = 3;
+    for (int i = 0; i < 20000; ++i) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        NodeId id = (seed >> 33) % universe;
+        if (i % 2 == 0) {
+            a.insert(id);
+            a_ref.insert(id);
+        }
+        else {
+            b.insert(id);
+            b_ref.insert(id);
+        }
+    }
+    std::vector<NodeId> expected;
+    std::set_union(a_ref.begin(), a_ref.end(), b_ref.begin(), b_ref.end(), std::back_inserter(expected));
+    ASSERT_EQ((a | b).toVector(), expected);
+    ASSERT_EQ((a | b).count(), expected.size());
+    expected.clear();
+    std::set_intersection(a_ref.begin(), a_ref.end(), b_ref.begin(), b_ref.end(), std::back_inserter(expected));
+    ASSERT_EQ((a & b).toVector(), expected);
+    expected.clear();
+    std::set_difference(a_ref.begin(), a_ref.end(), b_ref.begin(), b_ref.end(), std::back_inserter(expected));
+    ASSERT_EQ((a - b).toVector(), expected);
+    ASSERT_EQ(a - b - a, NodeSet(universe));
+    ASSERT_THROW(a |= NodeSet(universe + 1), std::runtime_error);
+}
@@ -0,0 +1,56 @@
+#include "small_vector.h"
+#include <gtest/gtest.h>
+
+TEST(SmallVectorTests, staysInline) {
+    SmallVector<int, 4> v;
+    for (int i = 0; i < 4; ++i) {
+        v.push_back(i);
+    }
+    ASSERT_TRUE(v.isInline());
+    ASSERT_EQ(v.size(), 4);
+    ASSERT_EQ(v[3], 3);
+}
+
+TEST(SmallVectorTests, spillsToHeap) {
+    SmallVector<int, 4> v;
+    for (int i = 0; i < 100; ++i) {
+        v.push_back(i);
+    }
+    ASSERT_FALSE(v.isInline());
+    ASSERT_EQ(v.size(), 100);
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(v[i], i);
+    }
+}
+
+TEST(SmallVectorTests, erase) {
+    SmallVector<int, 2> v;
+    for (int i = 0; i < 5; ++i) {
+        v.push_back(i);
+    }
+    v.erase(v.begin() + 1);
+    ASSERT_EQ(std::vector<int>(v.begin(), v.end()), (std::vector<int>{0, 2, 3, 4}));
+    v.erase(v.end() - 1);
+    ASSERT_EQ(std::vector<int>(v.begin(), v.end()), (std::vector<int>{0, 2, 3}));
+}
+
+TEST(SmallVectorTests, copyAndMove) {
+    SmallVector<int, 2> small, large;
+    small.push_back(7);
+    for (int i = 0; i < 10; ++i) {
+        large.push_back(i);
+    }
+    SmallVector<int, 2> small_copy(small), large_copy(large);
+    ASSERT_EQ(small_copy[0], 7);
+    ASSERT_EQ(large_copy.size(), 10);
+    ASSERT_EQ(large_copy[9], 9);
+    SmallVector<int, 2> large_moved(std::move(large));
+    ASSERT_EQ(large_moved.size(), 10);
+    ASSERT_EQ(large.size(), 0);
+    ASSERT_TRUE(large.isInline());
+    small_copy = large_moved;
+    ASSERT_EQ(small_copy.size(), 10);
+    large_moved = std::move(small);
+    ASSERT_EQ(large_moved.size(), 1);
+    ASSERT_EQ(large_moved[0], 7);
+}
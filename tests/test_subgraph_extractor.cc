@@ -1,5 +1,28 @@
 #include "subgraph_extractor.h"
 #include <gtest/gtest.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <tuple>
+
+static std::atomic<size_t> g_num_allocations{0};
+
+void* operator new(size_t size) {
+    g_num_allocations++;
+    if (void* p = std::malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
 
 TEST(LineGraphTests, extractSequence) {
     auto graph = std::make_unique<DirectedGraph>("g");
@@ -14,7 +37,681 @@ TEST(LineGraphTests, extractSequence) {
     SubgraphExtractor ex(graph.get());
     for (auto& [start, end]: std::vector<std::pair<int, int>>{{0,0}, {4,4}, {0,1}, {1,3}, {2,4}, {2,3}, {0,4}}) {
         auto subg = ex.extract({nodes[start]}, {nodes[end]});
-        ASSERT_TRUE(subg->nodes().size() == end - start + 1);
+        ASSERT_TRUE(subg.nodes().size() == end - start + 1);
+    }
+}
+
+
+TEST(LineGraphTests, extractFromCompactGraph) {
+    DirectedGraph graph("g");
+    std::vector<std::shared_ptr<Node>> nodes;
+    for (int i = 0; i < 6; ++i) {
+        nodes.push_back(std::make_shared<Node>(i));
+        if (i > 0) {
+            graph.addEdge(nodes[i - 1], nodes[i]);
+        }
+    }
+    auto compact = graph.freeze();
+    SubgraphExtractor ex(&compact);
+    auto subg = ex.extract({nodes[1]}, {nodes[3]});
+    ASSERT_EQ(subg.nodes().size(), 3);
+    ASSERT_EQ(subg.edges().size(), 2);
+    ASSERT_EQ(subg.top().front()->name(), nodes[1]->name());
+    ASSERT_EQ(subg.bottom().front()->name(), nodes[3]->name());
+}
+
+TEST(LineGraphTests, materializeSharesInternedNames) {
+    DirectedGraph graph("g");
+    std::vector<NodeId> ids;
+    for (int i = 0; i < 4; ++i) {
+        ids.push_back(graph.createNode(i, "n" + std::to_string(i)));
+        if (i > 0) {
+            graph.addEdge(ids[i - 1], ids[i]);
+        }
+    }
+    SubgraphExtractor ex(&graph);
+    auto subg = ex.extract({graph.node(ids[1])}, {graph.node(ids[2])}).materialize();
+    ASSERT_EQ(subg->names(), graph.names());
+    auto sub_node = subg->nodeByName("n2").value();
+    ASSERT_EQ(sub_node->name().data(), graph.get(ids[2]).name().data());
+    ASSERT_EQ(graph.names()->size(), 4);
+}
+
+TEST(LineGraphTests, extractAfterGraphChange) {
+    DirectedGraph graph("g");
+    auto a = std::make_shared<Node>(0);
+    auto b = std::make_shared<Node>(1);
+    auto c = std::make_shared<Node>(2);
+    graph.addEdge(a, b);
+    SubgraphExtractor ex(&graph);
+    ASSERT_EQ(ex.extract({a}, {b}).nodes().size(), 2);
+    graph.addEdge(b, c);
+    ASSERT_EQ(ex.extract({a}, {c}).nodes().size(), 3);
+}
+
+TEST(LineGraphTests, extractDeepChain) {
+    // deep enough to overflow the call stack with a recursive traversal
+    const int length = 300000;
+    DirectedGraph graph("g");
+    std::vector<PtrNode> nodes;
+    nodes.reserve(length);
+    for (int i = 0; i < length; ++i) {
+        nodes.push_back(std::make_shared<Node>(i));
+        if (i > 0) {
+            graph.addEdge(nodes[i - 1], nodes[i]);
+        }
+    }
+    SubgraphExtractor ex(&graph);
+    auto subg = ex.extract({nodes[10]}, {nodes[length - 10]});
+    ASSERT_EQ(subg.nodes().size(), length - 19);
+}
+
+TEST(LineGraphTests, extractRejectsInvalidBoundary) {
+    // a -> b -> c -> d, a -> e
+    DirectedGraph graph("g");
+    std::vector<NodeId> n;
+    for (const char* name: {"a", "b", "c", "d", "e"}) {
+        n.push_back(graph.createNode(0, name));
+    }
+    graph.addEdge(n[0], n[1]);
+    graph.addEdge(n[1], n[2]);
+    graph.addEdge(n[2], n[3]);
+    graph.addEdge(n[0], n[4]);
+    SubgraphExtractor ex(&graph);
+    auto node = [&](int i) { return graph.node(n[i]); };
+    ASSERT_EQ(ex.extract({node(1), node(4)}, {node(3), node(4)}).size(), 4);
+    ASSERT_THROW(ex.extract({node(1)}, {node(4)}), std::runtime_error);
+    ASSERT_THROW(ex.extract({node(2)}, {node(1)}), std::runtime_error);
+    ASSERT_THROW(ex.extract({node(0), node(2)}, {node(3)}), std::runtime_error);
+    ASSERT_THROW(ex.extract({node(0)}, {node(4), node(3), node(1)}), std::runtime_error);
+    try {
+        ex.extract({node(2), node(0)}, {node(3)});
+        FAIL();
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "Input: a is an ancestor of Input: c");
+    }
+}
+
+TEST(LineGraphTests, extractRejectsInvalidBoundaryOnCycle) {
+    // a -> x <-> b -> c, and a wide fan of unrelated inputs
+    DirectedGraph graph("g");
+    NodeId a = graph.createNode(0, "a");
+    NodeId x = graph.createNode(0, "x");
+    NodeId b = graph.createNode(0, "b");
+    NodeId c = graph.createNode(0, "c");
+    graph.addEdge(a, x);
+    graph.addEdge(x, b);
+    graph.addEdge(b, x);
+    graph.addEdge(b, c);
+    std::vector<PtrNode> fan;
+    for (int i = 0; i < 300; ++i) {
+        NodeId id = graph.createNode(0, "f" + std::to_string(i));
+        graph.addEdge(id, c);
+        fan.push_back(graph.node(id));
+    }
+    SubgraphExtractor ex(&graph);
+    std::vector<PtrNode> inputs(fan);
+    inputs.push_back(graph.node(b));
+    ASSERT_EQ(ex.extract(inputs, {graph.node(c)}).size(), 303);
+    inputs.push_back(graph.node(a));
+    try {
+        ex.extract(inputs, {graph.node(c)});
+        FAIL();
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "Input: a is an ancestor of Input: b");
+    }
+    try {
+        ex.extract({graph.node(c)}, {graph.node(x)});
+        FAIL();
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "Output: x is not reachable from the inputs");
     }
 }
 
+TEST(LineGraphTests, parallelSweepsMatchSerial) {
+    DirectedGraph graph("g");
+    const int width = 3000;
+    std::vector<NodeId> ids;
+    for (int i = 0; i < 8 * width; ++i) {
+        ids.push_back(graph.createNode(i));
+    }
+    for (int layer = 0; layer < 7; ++layer) {
+        for (int i = 0; i < width; ++i) {
+            graph.addEdge(ids[layer * width + i], ids[(layer + 1) * width + i]);
+            graph.addEdge(ids[layer * width + i], ids[(layer + 1) * width + (i + 1) % width]);
+        }
+    }
+    std::vector<PtrNode> inputs{graph.node(ids[width + 5]), graph.node(ids[width + 900])};
+    std::vector<PtrNode> outputs{graph.node(ids[6 * width + 10]), graph.node(ids[6 * width + 903])};
+    SubgraphExtractor serial(&graph);
+    SubgraphExtractor parallel(&graph);
+    parallel.setParallelism(0, 4);
+    ASSERT_EQ(parallel.extract(inputs, outputs).ids(), serial.extract(inputs, outputs).ids());
+    ASSERT_EQ(parallel.extract(outputs, outputs).ids(), serial.extract(outputs, outputs).ids());
+}
+
+TEST(WorkspaceTests, repeatedExtractionDoesNotAllocate) {
+    DirectedGraph graph("g");
+    std::vector<PtrNode> nodes;
+    for (int i = 0; i < 1000; ++i) {
+        nodes.push_back(std::make_shared<Node>(i));
+        if (i > 0) {
+            graph.addEdge(nodes[i - 1], nodes[i]);
+        }
+        if (i > 1) {
+            graph.addEdge(nodes[i - 2], nodes[i]);
+        }
+    }
+    SubgraphExtractor ex(&graph);
+    const CompactDirectedGraph& compact = ex.compactGraph();
+    std::vector<NodeId> inputs{compact.id(nodes[100]).value(), compact.id(nodes[101]).value()};
+    std::vector<NodeId> outputs{compact.id(nodes[900]).value()};
+    size_t expected = ex.extractNodes(inputs, outputs).size();
+
+    size_t allocations_before = g_num_allocations;
+    size_t total = 0;
+    for (int i = 0; i < 100; ++i) {
+        total += ex.extractNodes(inputs, outputs).size();
+        total += ex.extractNodes(outputs, outputs).size();
+    }
+    size_t allocations_after = g_num_allocations;
+    ASSERT_EQ(allocations_after, allocations_before);
+    ASSERT_EQ(total, 100 * (expected + 1));
+    ASSERT_EQ(expected, 900); // the forward sweep skips past 900 via the 899->901 edge
+}
+
+TEST(WorkspaceTests, largeGraphExtractionDoesNotAllocate) {
+    const NodeId num_nodes = (NodeId{1} << 16) + 1000;
+    GraphBuilder builder(num_nodes);
+    for (NodeId id = 0; id < num_nodes; ++id) {
+        builder.createNode(id, int(id));
+        if (id + 1 < num_nodes) {
+            builder.addEdge(id, id + 1);
+        }
+        if (id + 2 < num_nodes) {
+            builder.addEdge(id, id + 2);
+        }
+    }
+    auto graph = builder.build();
+    SubgraphExtractor ex(graph.get());
+    ex.compactGraph();
+    std::vector<NodeId> inputs{100, 101};
+    std::vector<NodeId> outputs{num_nodes - 100};
+    size_t expected = ex.extractNodes(inputs, outputs).size();
+
+    size_t allocations_before = g_num_allocations;
+    size_t total = 0;
+    for (int i = 0; i < 10; ++i) {
+        total += ex.extractNodes(inputs, outputs).size();
+    }
+    ASSERT_EQ(g_num_allocations, allocations_before);
+    ASSERT_EQ(total, 10 * expected);
+
+    // wide enough that levels are split across the pool's threads
+    std::vector<NodeId> wide_inputs;
+    for (NodeId id = 100; id < 100 + 4096; ++id) {
+        wide_inputs.push_back(id);
+    }
+    size_t expected_wide = ex.extractNodes(wide_inputs, outputs).size();
+    ex.setParallelism(0, 4);
+    ASSERT_EQ(ex.extractNodes(wide_inputs, outputs).size(), expected_wide);
+    allocations_before = g_num_allocations;
+    total = 0;
+    for (int i = 0; i < 10; ++i) {
+        total += ex.extractNodes(wide_inputs, outputs).size();
+    }
+    ASSERT_EQ(g_num_allocations, allocations_before);
+    ASSERT_EQ(total, 10 * expected_wide);
+}
+
+TEST(WorkspaceTests, workspaceFollowsGraphChanges) {
+    DirectedGraph graph("g");
+    auto a = std::make_shared<Node>(0);
+    auto b = std::make_shared<Node>(1);
+    graph.addEdge(a, b);
+    SubgraphExtractor ex(&graph);
+    ASSERT_EQ(ex.extract({a}, {b}).nodes().size(), 2);
+    auto c = std::make_shared<Node>(2);
+    graph.addEdge(b, c);
+    ASSERT_EQ(ex.extract({a}, {c}).nodes().size(), 3);
+    ASSERT_EQ(ex.extract({b}, {c}).nodes().size(), 2);
+}
+
+TEST(SubgraphViewTests, restrictedQueries) {
+    // a -> b -> d -> e, a -> c -> d; extracting b..d drops a and e
+    DirectedGraph graph("g");
+    std::vector<NodeId> n;
+    for (const char* name: {"a", "b", "c", "d", "e"}) {
+        n.push_back(graph.createNode(0, name));
+    }
+    graph.addEdge(n[0], n[1]);
+    graph.addEdge(n[0], n[2]);
+    graph.addEdge(n[1], n[3]);
+    graph.addEdge(n[2], n[3]);
+    graph.addEdge(n[3], n[4]);
+    SubgraphExtractor ex(&graph);
+    SubgraphView view = ex.extract({graph.node(n[1]), graph.node(n[2])}, {graph.node(n[3])});
+    ASSERT_EQ(view.size(), 3);
+    ASSERT_TRUE(view.contains(n[2]));
+    ASSERT_FALSE(view.contains(n[0]));
+    ASSERT_FALSE(view.contains(graph.node(n[4])));
+    ASSERT_EQ(view.topIds(), (std::vector<NodeId>{n[1], n[2]}));
+    ASSERT_EQ(view.bottomIds(), std::vector<NodeId>{n[3]});
+    ASSERT_EQ(view.sortedIds().back(), n[3]);
+    ASSERT_EQ(view.edges().size(), 2);
+    ASSERT_EQ(view.top().front(), graph.node(n[1]));
+
+    auto materialized = view.materialize();
+    ASSERT_EQ(materialized->size(), 3);
+    ASSERT_EQ(materialized->edges().size(), 2);
+    ASSERT_EQ(materialized->bottom().front()->name(), "d");
+}
+
+TEST(SubgraphViewTests, edgeRangeKeepsLabelsWithoutAllocating) {
+    // a -x-> b -y-> c -> d; the view holds a..c
+    DirectedGraph graph("g");
+    std::vector<NodeId> n;
+    for (const char* name: {"a", "b", "c", "d"}) {
+        n.push_back(graph.createNode(0, name));
+    }
+    graph.addEdge(n[0], n[1], "x");
+    graph.addEdge(n[1], n[2], "y");
+    graph.addEdge(n[2], n[3]);
+    SubgraphExtractor ex(&graph);
+    SubgraphView view = ex.extract({graph.node(n[0])}, {graph.node(n[2])});
+    size_t allocations_before = g_num_allocations;
+    size_t num_edges = 0;
+    size_t label_chars = 0;
+    for (const auto& edge: view.edgeRange()) {
+        num_edges++;
+        label_chars += edge.label.size();
+    }
+    ASSERT_EQ(g_num_allocations, allocations_before);
+    ASSERT_EQ(num_edges, 2);
+    ASSERT_EQ(label_chars, 2);
+    ASSERT_EQ(view.edges().back().label, "y");
+    auto materialized = view.materialize();
+    ASSERT_EQ(materialized->edges().front().label, "x");
+}
+
+TEST(SubgraphViewTests, outlivesGraphChanges) {
+    DirectedGraph graph("g");
+    auto a = std::make_shared<Node>(0);
+    auto b = std::make_shared<Node>(1);
+    auto c = std::make_shared<Node>(2);
+    graph.addEdge(a, b);
+    SubgraphExtractor ex(&graph);
+    auto before = ex.extract({a}, {b});
+    graph.addEdge(b, c);
+    auto after = ex.extract({a}, {c});
+    // the first view still reads the snapshot it was extracted from
+    ASSERT_EQ(before.parent().size(), 2);
+    ASSERT_EQ(before.nodes_sorted(), (std::vector<PtrNode>{a, b}));
+    ASSERT_EQ(after.nodes_sorted(), (std::vector<PtrNode>{a, b, c}));
+}
+
+TEST(SubgraphViewTests, extractBetweenDropsSideBranches) {
+    // a -> b -> c plus a dead end b -> x that extract keeps and extractBetween drops
+    DirectedGraph graph("g");
+    std::vector<NodeId> n;
+    for (const char* name: {"a", "b", "c", "x"}) {
+        n.push_back(graph.createNode(0, name));
+    }
+    graph.addEdge(n[0], n[1]);
+    graph.addEdge(n[1], n[2]);
+    graph.addEdge(n[1], n[3]);
+    SubgraphExtractor ex(&graph);
+    ASSERT_EQ(ex.extract({graph.node(n[0])}, {graph.node(n[2])}).size(), 4);
+    auto between = ex.extractBetween({graph.node(n[0])}, {graph.node(n[2])});
+    ASSERT_EQ(between.ids(), (std::vector<NodeId>{n[0], n[1], n[2]}));
+    ASSERT_TRUE(ex.reachability().isAncestor(n[0], n[3]));
+    graph.addEdge(n[3], n[2]);
+    ASSERT_EQ(ex.extractBetween({graph.node(n[0])}, {graph.node(n[2])}).size(), 4);
+}
+
+TEST(SubgraphViewTests, extractRegionTakesWholeBlock) {
+    // x -> s -> {a -> b, skip} -> j -> y
+    DirectedGraph graph("g");
+    std::vector<NodeId> n;
+    for (const char* name: {"x", "s", "a", "b", "j", "y"}) {
+        n.push_back(graph.createNode(0, name));
+    }
+    for (auto [from, to]: std::vector<std::pair<int, int>>{{0, 1}, {1, 2}, {2, 3}, {3, 4}, {1, 4}, {4, 5}}) {
+        graph.addEdge(n[from], n[to]);
+    }
+    SubgraphExtractor ex(&graph);
+    auto block = ex.extractRegion(graph.node(n[3]));
+    ASSERT_EQ(block.ids(), (std::vector<NodeId>{n[1], n[2], n[3], n[4]}));
+    ASSERT_EQ(ex.regions().regions().size(), 1);
+    ASSERT_THROW(ex.extractRegion(graph.node(n[5])), std::runtime_error);
+    graph.addEdge(graph.createNode(0, "z"), n[2]);
+    ASSERT_THROW(ex.extractRegion(graph.node(n[3])), std::runtime_error);
+    // a region from a bigger graph
+    ASSERT_THROW(ex.extractRegion(SeseRegion{n[1], 1000}), std::runtime_error);
+    ASSERT_THROW(ex.extractRegion(SeseRegion{1000, n[4]}), std::runtime_error);
+}
+
+static std::unique_ptr<onnx::ModelProto> makeDiamondModel() {
+    // x -> A -> a, x -> B -> b, (a, b) -> C -> y
+    auto model = std::make_unique<onnx::ModelProto>();
+    auto* graph = model->mutable_graph();
+    auto add_node = [&](const std::string& name, const std::string& op_type,
+            std::vector<std::string> inputs, std::vector<std::string> outputs) {
+        auto* node = graph->add_node();
+        node->set_name(name);
+        node->set_op_type(op_type);
+        for (const auto& in: inputs) {
+            node->add_input(in);
+        }
+        for (const auto& out: outputs) {
+            node->add_output(out);
+        }
+    };
+    add_node("A", "Relu", {"x"}, {"a"});
+    add_node("B", "Sigmoid", {"x"}, {"b"});
+    add_node("C", "Add", {"a", "b"}, {"y"});
+    graph->add_input()->set_name("x");
+    graph->add_output()->set_name("y");
+    return model;
+}
+
+TEST(OnnxModelTests, convert) {
+    OnnxModel model(makeDiamondModel());
+    OnnxGraph* graph = model.graph();
+    ASSERT_EQ(graph->nodes().size(), 3);
+    ASSERT_EQ(graph->edges().size(), 2);
+    auto c = graph->nodeByName("C").value();
+    ASSERT_EQ(c->data().op_type(), "Add");
+    ASSERT_EQ(graph->inbound(c).size(), 2);
+    ASSERT_EQ(graph->top().size(), 2);
+    ASSERT_EQ(graph->bottom(), std::vector<OnnxGraph::NodePtr>{c});
+}
+
+TEST(OnnxModelTests, extract) {
+    auto model = std::make_shared<OnnxModel>(makeDiamondModel());
+    OnnxSubgraphExtractor ex(model);
+    auto sub = ex.extract({"A", "B"}, {"C"});
+    ASSERT_EQ(sub->graph()->nodes().size(), 3);
+    ASSERT_EQ(sub->graph()->edges().size(), 2);
+    auto single = ex.extract({"B"}, {"B"});
+    ASSERT_EQ(single->graph()->nodes().size(), 1);
+    ASSERT_TRUE(single->graph()->nodeByName("B").has_value());
+    ASSERT_THROW(ex.extract({"A", "nope"}, {"missing"}), std::runtime_error);
+}
+
+TEST(OnnxModelTests, regionsSkipConstants) {
+    // x -> S -> {A -> R, skip} -> J -> y, with a Constant feeding R's shape
+    auto model_proto = std::make_unique<onnx::ModelProto>();
+    auto* graph = model_proto->mutable_graph();
+    auto add_node = [&](const std::string& name, const std::string& op_type,
+            std::vector<std::string> inputs, std::vector<std::string> outputs) {
+        auto* node = graph->add_node();
+        node->set_name(name);
+        node->set_op_type(op_type);
+        for (const auto& in: inputs) {
+            node->add_input(in);
+        }
+        for (const auto& out: outputs) {
+            node->add_output(out);
+        }
+    };
+    add_node("S", "Relu", {"x"}, {"s"});
+    add_node("A", "MatMul", {"s", "w"}, {"a"});
+    add_node("K", "Constant", {}, {"k"});
+    add_node("R", "Reshape", {"a", "k"}, {"r"});
+    add_node("J", "Add", {"r", "s"}, {"y"});
+    graph->add_input()->set_name("x");
+    graph->add_output()->set_name("y");
+    graph->add_initializer()->set_name("w");
+    auto model = std::make_shared<OnnxModel>(std::move(model_proto));
+    OnnxSubgraphExtractor ex(model);
+    auto ids = model->adapter().idsByName({"S", "K", "J"});
+    auto regions = ex.regions();
+    ASSERT_EQ(regions.size(), 1);
+    ASSERT_EQ(regions[0].entry, ids[0]);
+    ASSERT_EQ(regions[0].exit, ids[2]);
+    ASSERT_TRUE(model->isSideInput(ids[1]));
+    auto block = ex.extractRegion("R");
+    ASSERT_EQ(block->graph()->nodes().size(), 5);
+    ASSERT_TRUE(block->graph()->nodeByName("K").has_value());
+    ASSERT_THROW(ex.extractRegion("K"), std::runtime_error);
+    ASSERT_THROW(ex.extractRegion(SeseRegion{ids[0], 5}), std::runtime_error);
+
+    // on the converted graph the Constant is one more source reaching the join
+    BasicSubgraphExtractor<onnx::NodeProto> generic(model->graph());
+    ASSERT_TRUE(generic.regions().regions().empty());
+}
+
+TEST(OnnxModelTests, adapterAnswersNeighborQueries) {
+    auto proto = makeDiamondModel();
+    auto* square = proto->mutable_graph()->add_node();
+    square->set_name("D");
+    square->set_op_type("Mul");
+    square->add_input("y");
+    square->add_input("y");
+    square->add_output("z");
+    OnnxGraphAdapter adapter(proto->graph());
+    ASSERT_EQ(adapter.size(), 4);
+    auto ids = adapter.idsByName({"A", "B", "C", "D"});
+    auto list = [](NodeIdRange range) { return std::vector<NodeId>(range.begin(), range.end()); };
+    ASSERT_EQ(list(adapter.inbound(ids[2])), (std::vector<NodeId>{ids[0], ids[1]}));
+    ASSERT_EQ(list(adapter.outbound(ids[0])), (std::vector<NodeId>{ids[2]}));
+    ASSERT_EQ(list(adapter.inbound(ids[3])), (std::vector<NodeId>{ids[2]}));
+    ASSERT_EQ(topIds(adapter), (std::vector<NodeId>{ids[0], ids[1]}));
+    ASSERT_EQ(sortedIds(adapter).back(), ids[3]);
+    ASSERT_THROW(adapter.idsByName({"E"}), std::runtime_error);
+    {
+        // "" is an omitted optional value, not an edge between E and F
+        auto omitted = makeDiamondModel();
+        auto* dropout = omitted->mutable_graph()->add_node();
+        dropout->set_name("E");
+        dropout->add_input("y");
+        dropout->add_output("e");
+        dropout->add_output("");
+        auto* clip = omitted->mutable_graph()->add_node();
+        clip->set_name("F");
+        clip->add_input("x");
+        clip->add_input("");
+        clip->add_output("f");
+        OnnxGraphAdapter omitted_adapter(omitted->graph());
+        auto clip_id = omitted_adapter.idsByName({"F"}).front();
+        ASSERT_TRUE(omitted_adapter.inbound(clip_id).empty());
+        ASSERT_EQ(topIds(omitted_adapter).size(), 3);
+    }
+
+    auto model = std::make_shared<OnnxModel>(std::move(proto));
+    OnnxSubgraphExtractor ex(model);
+    auto sub = ex.extract({"B"}, {"D"});
+    ASSERT_EQ(sub->graph()->nodes().size(), 4);
+    ASSERT_EQ(model->graph()->edges().size(), 3);
+    try {
+        ex.extract({"A", "C"}, {"D"});
+        FAIL();
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "Input: A is an ancestor of Input: C");
+    }
+    ASSERT_THROW(ex.extract({"D"}, {"A"}), std::runtime_error);
+}
+
+TEST(OnnxModelTests, extractDefaultsSkipConstantSinks) {
+    // a dead Constant K, and a Constant L feeding a Cast M nothing reads
+    auto proto = makeDiamondModel();
+    auto* graph = proto->mutable_graph();
+    for (auto [name, op_type, in, out]: {std::make_tuple("K", "Constant", "", "k"), std::make_tuple("L", "Constant", "", "l"),
+            std::make_tuple("M", "Cast", "l", "m")}) {
+        auto* node = graph->add_node();
+        node->set_name(name);
+        node->set_op_type(op_type);
+        if (*in != '\0') {
+            node->add_input(in);
+        }
+        node->add_output(out);
+    }
+    auto model = std::make_shared<OnnxModel>(std::move(proto));
+    OnnxSubgraphExtractor ex(model);
+    ASSERT_EQ(ex.extract({}, {})->graph()->nodes().size(), 6);
+    ASSERT_EQ(ex.extract({"C"}, {})->graph()->nodes().size(), 4);
+    ASSERT_EQ(ex.extract({}, {"C"})->graph()->nodes().size(), 3);
+    ASSERT_EQ(ex.extract({}, {"M"})->graph()->nodes().size(), 5);
+    ASSERT_THROW(ex.extract({}, {"C", "A"}), std::runtime_error);
+    ASSERT_THROW(ex.extract({"A", "C"}, {}), std::runtime_error);
+    ASSERT_THROW(ex.extract({"B"}, {"M"}), std::runtime_error);
+}
+
+TEST(OnnxModelTests, boundaryChecksFollowRank) {
+    // a chain listed back to front: C reads b, B reads a, A reads x
+    auto proto = std::make_unique<onnx::ModelProto>();
+    auto* graph = proto->mutable_graph();
+    for (auto [name, in, out]: {std::make_tuple("C", "b", "c"), std::make_tuple("B", "a", "b"), std::make_tuple("A", "x", "a")}) {
+        auto* node = graph->add_node();
+        node->set_name(name);
+        node->add_input(in);
+        node->add_output(out);
+    }
+    graph->add_input()->set_name("x");
+    auto model = std::make_shared<OnnxModel>(std::move(proto));
+    const OnnxGraphAdapter& adapter = model->adapter();
+    auto ids = adapter.idsByName({"A", "B", "C"});
+    ASSERT_LT(adapter.rank(ids[0]), adapter.rank(ids[1]));
+    ASSERT_LT(adapter.rank(ids[1]), adapter.rank(ids[2]));
+
+    OnnxSubgraphExtractor ex(model);
+    ASSERT_EQ(ex.extract({"A"}, {"C"})->graph()->nodes().size(), 3);
+    try {
+        ex.extract({"A", "C"}, {"C"});
+        FAIL();
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "Input: A is an ancestor of Input: C");
+    }
+    ASSERT_THROW(ex.extract({"B"}, {"A", "C"}), std::runtime_error);
+
+    // in listed order the rank is the index, and a window stays a window
+    auto chain = makeDiamondModel();
+    for (int i = 0; i < 1000; ++i) {
+        auto* node = chain->mutable_graph()->add_node();
+        node->set_name("D" + std::to_string(i));
+        node->add_input(i == 0 ? "y" : "d" + std::to_string(i - 1));
+        node->add_output("d" + std::to_string(i));
+    }
+    OnnxSubgraphExtractor window(std::make_shared<OnnxModel>(std::move(chain)));
+    ASSERT_EQ(window.extract({"D500"}, {"D509"})->graph()->nodes().size(), 10);
+    ASSERT_THROW(window.extract({"D509"}, {"D500"}), std::runtime_error);
+    ASSERT_THROW(window.extract({"D500", "D505"}, {"D509"}), std::runtime_error);
+}
+
+TEST(OnnxModelTests, workspaceRebindsToBiggerModel) {
+    // the small model is freed first, so the big one may well reuse its
+    // addresses; the thread's workspace must still grow to fit
+    {
+        auto small = std::make_shared<OnnxModel>(makeDiamondModel());
+        OnnxSubgraphExtractor ex(small);
+        ASSERT_EQ(ex.extract({"A", "B"}, {"C"})->graph()->nodes().size(), 3);
+    }
+    const int length = 5000;
+    auto proto = makeDiamondModel();
+    for (int i = 0; i < length; ++i) {
+        auto* node = proto->mutable_graph()->add_node();
+        node->set_name("D" + std::to_string(i));
+        node->set_op_type("Relu");
+        node->add_input(i == 0 ? "y" : "d" + std::to_string(i - 1));
+        node->add_output("d" + std::to_string(i));
+    }
+    auto big = std::make_shared<OnnxModel>(std::move(proto));
+    OnnxSubgraphExtractor ex(big);
+    std::string last = "D" + std::to_string(length - 1);
+    ASSERT_EQ(ex.extract({"A", "B"}, {last})->graph()->nodes().size(), length + 3);
+    ASSERT_EQ(ex.extract({"D10"}, {last})->graph()->nodes().size(), length - 10);
+}
+
+TEST(OnnxModelTests, alternatingModelsKeepTheirWorkspaces) {
+    auto chain = [](int length) {
+        auto proto = makeDiamondModel();
+        for (int i = 0; i < length; ++i) {
+            auto* node = proto->mutable_graph()->add_node();
+            node->set_name("D" + std::to_string(i));
+            node->add_input(i == 0 ? "y" : "d" + std::to_string(i - 1));
+            node->add_output("d" + std::to_string(i));
+        }
+        return std::make_shared<OnnxModel>(std::move(proto));
+    };
+    std::vector<std::shared_ptr<OnnxModel>> models;
+    for (int length: {10, 2000, 30, 400, 50}) {
+        models.push_back(chain(length));
+    }
+    // five models take turns on one thread's four workspaces
+    for (int round = 0; round < 3; ++round) {
+        for (const auto& model: models) {
+            OnnxSubgraphExtractor ex(model);
+            ASSERT_EQ(ex.extract({"C"}, {"D9"})->graph()->nodes().size(), 11);
+            ASSERT_EQ(ex.extract({"A", "B"}, {"C"})->graph()->nodes().size(), 3);
+        }
+    }
+}
+
+TEST(OnnxModelTests, concurrentExtractOnSharedModel) {
+    // a chain of diamonds: Ri feeds Ri+1 directly and through Si; each Ri reads weight wi
+    const int length = 200;
+    auto proto = std::make_unique<onnx::ModelProto>();
+    auto* graph = proto->mutable_graph();
+    for (int i = 0; i < length; ++i) {
+        std::string r = "r" + std::to_string(i);
+        auto* rung = graph->add_node();
+        rung->set_name("R" + std::to_string(i));
+        rung->add_input(i == 0 ? "x" : "r" + std::to_string(i - 1));
+        if (i >= 1) {
+            rung->add_input("s" + std::to_string(i - 1));
+        }
+        rung->add_input("w" + std::to_string(i));
+        rung->add_output(r);
+        auto* side = graph->add_node();
+        side->set_name("S" + std::to_string(i));
+        side->add_input(r);
+        side->add_output("s" + std::to_string(i));
+        graph->add_value_info()->set_name(r);
+        graph->add_initializer()->set_name("w" + std::to_string(i));
+    }
+    std::shared_ptr<const OnnxModel> model = std::make_shared<OnnxModel>(std::move(proto));
+    ASSERT_EQ(model->getValueInfo("r3").name(), "r3");
+    ASSERT_EQ(model->findTensorProto("r3"), nullptr);
+    ASSERT_THROW(model->getTensorProto("r3"), std::out_of_range);
+
+    const OnnxSubgraphExtractor ex(model);
+    auto query = [](int i) {
+        return std::make_pair(std::vector<std::string>{"R" + std::to_string(i)}, std::vector<std::string>{"R" + std::to_string(i + 20 + i % 7)});
+    };
+    auto summary = [](const std::unique_ptr<NNModel<onnx::NodeProto>>& sub) {
+        std::vector<std::string> names;
+        for (const auto& node: sub->graph()->nodes()) {
+            names.emplace_back(node->name());
+        }
+        return names;
+    };
+    const int num_queries = 40;
+    std::vector<std::vector<std::string>> expected;
+    for (int i = 0; i < num_queries; ++i) {
+        auto [inputs, outputs] = query(i);
+        expected.push_back(summary(ex.extract(inputs, outputs)));
+    }
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; ++t) {
+        workers.emplace_back([&, t] {
+            for (int round = 0; round < 3; ++round) {
+                for (int i = t; i < num_queries; i += 2) {
+                    auto [inputs, outputs] = query(i);
+                    mismatches += summary(ex.extract(inputs, outputs)) != expected[i];
+                }
+            }
+        });
+    }
+    for (auto& worker: workers) {
+        worker.join();
+    }
+    ASSERT_EQ(mismatches.load(), 0);
+    ASSERT_EQ(expected[0].size(), 41);
+}